@@ -0,0 +1,60 @@
+#include "Camera.h"
+#include <algorithm>
+#include <cmath>
+
+
+Camera::View Camera::GetView(int gridWidth, int gridHeight)
+{
+    double width = gridWidth / zoom;
+    double height = gridHeight / zoom;
+    return { centerX * gridWidth - width * 0.5, centerY * gridHeight - height * 0.5, width, height };
+}
+
+void Camera::Reset()
+{
+    centerX = 0.5;
+    centerY = 0.5;
+    zoom = 1.0;
+}
+
+void Camera::ZoomAt(double factor, double screenX, double screenY, int windowWidth, int windowHeight)
+{
+    if (windowWidth <= 0 || windowHeight <= 0) return;
+
+    // Offset of the mouse from the window center, in window widths and heights
+    double offsetX = screenX / windowWidth - 0.5;
+    double offsetY = screenY / windowHeight - 0.5;
+
+    // Point under the mouse as a fraction of the grid, before and after must match
+    double pointX = centerX + offsetX / zoom;
+    double pointY = centerY + offsetY / zoom;
+
+    zoom = std::clamp(zoom * factor, 1.0, MaxZoom);
+    centerX = pointX - offsetX / zoom;
+    centerY = pointY - offsetY / zoom;
+    Clamp();
+}
+
+void Camera::Pan(double deltaX, double deltaY, int windowWidth, int windowHeight)
+{
+    if (windowWidth <= 0 || windowHeight <= 0) return;
+
+    centerX -= deltaX / windowWidth / zoom;
+    centerY -= deltaY / windowHeight / zoom;
+    Clamp();
+}
+
+void Camera::ScreenToGrid(double screenX, double screenY, int windowWidth, int windowHeight,
+    int gridWidth, int gridHeight, int& gridX, int& gridY)
+{
+    View view = GetView(gridWidth, gridHeight);
+    gridX = static_cast<int>(std::floor(view.x + screenX / windowWidth * view.width));
+    gridY = static_cast<int>(std::floor(view.y + screenY / windowHeight * view.height));
+}
+
+void Camera::Clamp()
+{
+    double half = 0.5 / zoom;
+    centerX = std::clamp(centerX, half, 1.0 - half);
+    centerY = std::clamp(centerY, half, 1.0 - half);
+}
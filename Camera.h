@@ -0,0 +1,42 @@
+#pragma once
+
+
+// Which part of the grid fills the window. The view keeps the grid's aspect ratio and is
+// stored as fractions of the grid, so it survives grid resizes. Zoom 1 shows the whole grid.
+class Camera
+{
+public:
+	// Visible part of the grid in cells, fractional at the edges
+	struct View {
+		double x;
+		double y;
+		double width;
+		double height;
+	};
+
+	// Largest zoom, where a 16384 cell wide grid still shows 64 cells across
+	static constexpr double MaxZoom = 256.0;
+	// Zoom factor of one scroll wheel step
+	static constexpr double ZoomStep = 1.15;
+
+private:
+	static inline double centerX = 0.5;
+	static inline double centerY = 0.5;
+	static inline double zoom = 1.0;
+
+	// Keep the view inside the grid
+	static void Clamp();
+
+public:
+	static View GetView(int gridWidth, int gridHeight);
+	static double GetZoom() { return zoom; }
+	static void Reset();
+
+	// Multiply the zoom by factor, keeping the point under the window position (screenX, screenY) in place
+	static void ZoomAt(double factor, double screenX, double screenY, int windowWidth, int windowHeight);
+	// Move the view by a mouse drag of (deltaX, deltaY) window pixels, the grid follows the mouse
+	static void Pan(double deltaX, double deltaY, int windowWidth, int windowHeight);
+	// Cell under the window position (screenX, screenY), may lie outside the grid
+	static void ScreenToGrid(double screenX, double screenY, int windowWidth, int windowHeight,
+		int gridWidth, int gridHeight, int& gridX, int& gridY);
+};
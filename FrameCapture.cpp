@@ -0,0 +1,403 @@
+#include "FrameCapture.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#ifndef _WIN32
+#include <csignal>
+#endif
+
+
+bool FrameCapture::Start(const std::string& path, Format newFormat, bool everyFrame)
+{
+    if (capturing) return false;
+
+    format = newFormat;
+    outputPath = path;
+    keepEveryFrame = everyFrame;
+
+    if (format == Format::RawVideo) {
+        rawIsPipe = !path.empty() && path[0] == '|';
+        if (rawIsPipe) {
+#ifdef _WIN32
+            rawOutput = _popen(path.c_str() + 1, "wb");
+#else
+            // A command that exits early must not take the app down with it, writes just fail instead
+            std::signal(SIGPIPE, SIG_IGN);
+            rawOutput = popen(path.c_str() + 1, "w");
+#endif
+        }
+        else {
+            rawOutput = std::fopen(path.c_str(), "wb");
+        }
+
+        if (!rawOutput) {
+            std::cerr << "Failed to open capture output " << path << std::endl;
+            return false;
+        }
+    }
+    else {
+        std::filesystem::path directory = std::filesystem::path(path).parent_path();
+        std::error_code error;
+        if (!directory.empty()) std::filesystem::create_directories(directory, error);
+    }
+
+    width = 0;
+    height = 0;
+    nextSlot = 0;
+    pendingSlots = 0;
+    nextFrameIndex = 0;
+    queueDepth = 0;
+    droppedFrames = 0;
+    writtenFrames = 0;
+
+    stopWriter = false;
+    writer = std::thread(WriterLoop);
+    capturing = true;
+    return true;
+}
+
+void FrameCapture::CaptureFrame(int frameWidth, int frameHeight)
+{
+    if (!capturing) return;
+
+    // The ring is sized on the first frame, a raw stream cannot change size halfway
+    if (width == 0) {
+        width = frameWidth;
+        height = frameHeight;
+        CreateBuffers();
+        std::cout << "Capturing " << width << "x" << height << " " << FormatName(format) << " to " << outputPath << std::endl;
+    }
+    else if (frameWidth != width || frameHeight != height) {
+        std::cerr << "Capture stopped, the frame size changed" << std::endl;
+        Stop();
+        return;
+    }
+
+    // Hand every finished readback to the writer, oldest first so frames stay in order
+    while (pendingSlots > 0 && FinishOldest(false)) {}
+
+    // All slots still being copied, the GPU is behind the frame loop
+    if (pendingSlots == RingSize) {
+        if (!keepEveryFrame) {
+            droppedFrames.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        FinishOldest(true);
+    }
+
+    // Rows are tightly packed, 3 bytes per pixel
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, packBuffers[nextSlot]);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    packFences[nextSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    nextSlot = (nextSlot + 1) % RingSize;
+    ++pendingSlots;
+}
+
+void FrameCapture::Stop()
+{
+    if (!capturing) return;
+
+    // Frames already read back are kept even when dropping is allowed
+    keepEveryFrame = true;
+    while (pendingSlots > 0) FinishOldest(true);
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopWriter = true;
+    }
+    frameQueued.notify_one();
+    writer.join();
+
+    if (rawOutput) {
+#ifdef _WIN32
+        if (rawIsPipe) _pclose(rawOutput); else std::fclose(rawOutput);
+#else
+        if (rawIsPipe) pclose(rawOutput); else std::fclose(rawOutput);
+#endif
+        rawOutput = nullptr;
+    }
+
+    DeleteBuffers();
+    freeBuffers.clear();
+    capturing = false;
+
+    std::cout << "Capture finished, " << WrittenFrames() << " frames written, " << DroppedFrames() << " dropped" << std::endl;
+}
+
+const char* FrameCapture::FormatName(Format format)
+{
+    switch (format) {
+    case Format::PngSequence: return "PNG sequence";
+    case Format::RawVideo: return "Raw RGB video";
+    }
+    return "Unknown";
+}
+
+void FrameCapture::CreateBuffers()
+{
+    glGenBuffers(RingSize, packBuffers);
+    for (GLuint buffer : packBuffers) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>(width) * height * 3, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void FrameCapture::DeleteBuffers()
+{
+    for (GLsync& fence : packFences) {
+        if (fence) glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    if (packBuffers[0] != 0) glDeleteBuffers(RingSize, packBuffers);
+    for (GLuint& buffer : packBuffers) buffer = 0;
+}
+
+bool FrameCapture::FinishOldest(bool wait)
+{
+    int slot = (nextSlot + RingSize - pendingSlots) % RingSize;
+
+    // A zero timeout only polls, the flush makes sure the fence reaches the GPU at all
+    GLuint64 timeout = wait ? 1000000 : 0;
+    for (;;) {
+        GLenum result = glClientWaitSync(packFences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+        if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED) break;
+        if (!wait) return false;
+    }
+    glDeleteSync(packFences[slot]);
+    packFences[slot] = nullptr;
+
+    size_t size = static_cast<size_t>(width) * height * 3;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, packBuffers[slot]);
+    const uint8_t* pixels = static_cast<const uint8_t*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT));
+    if (pixels) {
+        Enqueue(pixels);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    --pendingSlots;
+    return true;
+}
+
+void FrameCapture::Enqueue(const uint8_t* pixels)
+{
+    std::vector<uint8_t> rgb;
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        if (queue.size() >= QueueCapacity) {
+            // The writer cannot keep up, losing a frame beats losing the frame rate
+            if (!keepEveryFrame) {
+                droppedFrames.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            frameTaken.wait(lock, [] { return queue.size() < QueueCapacity; });
+        }
+
+        if (!freeBuffers.empty()) {
+            rgb = std::move(freeBuffers.back());
+            freeBuffers.pop_back();
+        }
+    }
+
+    // GL returns the bottom row first, images and video players want the top row first
+    size_t rowBytes = static_cast<size_t>(width) * 3;
+    rgb.resize(rowBytes * height);
+    for (int y = 0; y < height; ++y) {
+        std::memcpy(rgb.data() + rowBytes * y, pixels + rowBytes * (height - 1 - y), rowBytes);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        queue.push_back({ std::move(rgb), nextFrameIndex++ });
+        queueDepth.store(static_cast<int>(queue.size()), std::memory_order_relaxed);
+    }
+    frameQueued.notify_one();
+}
+
+void FrameCapture::WriterLoop()
+{
+    bool failed = false;
+
+    for (;;) {
+        Frame frame;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            frameQueued.wait(lock, [] { return stopWriter || !queue.empty(); });
+            // Stop only once the queue is drained
+            if (queue.empty()) return;
+
+            frame = std::move(queue.front());
+            queue.pop_front();
+            queueDepth.store(static_cast<int>(queue.size()), std::memory_order_relaxed);
+        }
+        frameTaken.notify_one();
+
+        // After the first failed write the rest are counted as dropped, one error is enough
+        if (!failed && WriteFrame(frame)) {
+            writtenFrames.fetch_add(1, std::memory_order_relaxed);
+        }
+        else {
+            if (!failed) std::cerr << "Failed to write captured frame " << frame.index << std::endl;
+            failed = true;
+            droppedFrames.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        std::lock_guard<std::mutex> lock(queueMutex);
+        freeBuffers.push_back(std::move(frame.rgb));
+    }
+}
+
+bool FrameCapture::WriteFrame(const Frame& frame)
+{
+    if (format == Format::RawVideo) {
+        return std::fwrite(frame.rgb.data(), 1, frame.rgb.size(), rawOutput) == frame.rgb.size();
+    }
+
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), "_%06d.png", frame.index);
+    return WritePng(outputPath + suffix, frame.rgb.data(), width, height);
+}
+
+namespace {
+
+// Slicing by 8: eight bytes per step through eight tables, several times faster than one byte per lookup
+uint32_t Crc32(uint32_t crc, const uint8_t* data, size_t size)
+{
+    static const auto tables = [] {
+        std::array<std::array<uint32_t, 256>, 8> values{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; ++bit) value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+            values[0][i] = value;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int table = 1; table < 8; ++table) {
+                values[table][i] = values[0][values[table - 1][i] & 0xFF] ^ (values[table - 1][i] >> 8);
+            }
+        }
+        return values;
+    }();
+
+    crc = ~crc;
+    for (; size >= 8; data += 8, size -= 8) {
+        uint32_t low = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | static_cast<uint32_t>(data[3]) << 24);
+        crc = tables[7][low & 0xFF] ^ tables[6][(low >> 8) & 0xFF] ^ tables[5][(low >> 16) & 0xFF] ^ tables[4][low >> 24] ^
+              tables[3][data[4]] ^ tables[2][data[5]] ^ tables[1][data[6]] ^ tables[0][data[7]];
+    }
+    for (; size > 0; ++data, --size) crc = tables[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+void PutBigEndian(uint8_t* out, uint32_t value)
+{
+    out[0] = static_cast<uint8_t>(value >> 24);
+    out[1] = static_cast<uint8_t>(value >> 16);
+    out[2] = static_cast<uint8_t>(value >> 8);
+    out[3] = static_cast<uint8_t>(value);
+}
+
+// Length, type, data and the CRC over type and data
+void WriteChunk(std::ostream& out, const char* type, const uint8_t* data, size_t size)
+{
+    uint8_t length[4];
+    uint8_t crc[4];
+    PutBigEndian(length, static_cast<uint32_t>(size));
+    PutBigEndian(crc, Crc32(Crc32(0, reinterpret_cast<const uint8_t*>(type), 4), data, size));
+
+    out.write(reinterpret_cast<const char*>(length), 4);
+    out.write(type, 4);
+    out.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+    out.write(reinterpret_cast<const char*>(crc), 4);
+}
+
+}
+
+bool FrameCapture::WritePng(const std::string& path, const uint8_t* rgb, int width, int height)
+{
+    // Stored blocks skip compression entirely, the files are large but the writer never falls behind
+    constexpr size_t MaxStoredBlock = 65535;
+    constexpr uint32_t AdlerModulus = 65521;
+    constexpr size_t AdlerRun = 5552;
+
+    size_t rowBytes = static_cast<size_t>(width) * 3;
+    size_t rawSize = (rowBytes + 1) * height;
+
+    // Reused between frames, only the writer thread calls this
+    thread_local std::vector<uint8_t> zlib;
+    zlib.clear();
+    zlib.reserve(rawSize + rawSize / MaxStoredBlock * 5 + 16);
+
+    // Deflate with a 32K window, no preset dictionary, fastest level
+    zlib.push_back(0x78);
+    zlib.push_back(0x01);
+
+    uint32_t adlerLow = 1;
+    uint32_t adlerHigh = 0;
+    size_t blockLeft = 0;
+    size_t remaining = rawSize;
+
+    // Append scanline bytes, opening a new stored block header whenever the last one is full
+    auto put = [&](const uint8_t* data, size_t size) {
+        while (size > 0) {
+            if (blockLeft == 0) {
+                blockLeft = std::min(remaining, MaxStoredBlock);
+                remaining -= blockLeft;
+                uint16_t length = static_cast<uint16_t>(blockLeft);
+                zlib.push_back(remaining == 0 ? 1 : 0);
+                zlib.push_back(static_cast<uint8_t>(length));
+                zlib.push_back(static_cast<uint8_t>(length >> 8));
+                zlib.push_back(static_cast<uint8_t>(~length));
+                zlib.push_back(static_cast<uint8_t>(~length >> 8));
+            }
+
+            size_t count = std::min(size, blockLeft);
+            zlib.insert(zlib.end(), data, data + count);
+            // The sums cannot overflow 32 bits within AdlerRun bytes, so reduce once per run
+            for (size_t done = 0; done < count; ) {
+                size_t end = std::min(count, done + AdlerRun);
+                for (; done < end; ++done) {
+                    adlerLow += data[done];
+                    adlerHigh += adlerLow;
+                }
+                adlerLow %= AdlerModulus;
+                adlerHigh %= AdlerModulus;
+            }
+            data += count;
+            size -= count;
+            blockLeft -= count;
+        }
+    };
+
+    // Every scanline starts with filter type 0, the bytes follow unchanged
+    const uint8_t noFilter = 0;
+    for (int y = 0; y < height; ++y) {
+        put(&noFilter, 1);
+        put(rgb + rowBytes * y, rowBytes);
+    }
+    zlib.resize(zlib.size() + 4);
+    PutBigEndian(zlib.data() + zlib.size() - 4, (adlerHigh << 16) | adlerLow);
+
+    // 8-bit truecolor, no interlacing
+    uint8_t header[13] = {};
+    PutBigEndian(header, static_cast<uint32_t>(width));
+    PutBigEndian(header + 4, static_cast<uint32_t>(height));
+    header[8] = 8;
+    header[9] = 2;
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+    WriteChunk(file, "IHDR", header, sizeof(header));
+    WriteChunk(file, "IDAT", zlib.data(), zlib.size());
+    WriteChunk(file, "IEND", nullptr, 0);
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <GL/glew.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Records the rendered frames to disk without stalling the frame loop.
+// Each frame is read into a ring of pixel pack buffers and fenced, a later frame maps the buffer
+// once the fence has signaled and hands the pixels to a writer thread through a bounded queue.
+// When the ring or the queue is full the frame is dropped instead of waiting, unless every
+// frame was asked for, as the headless mode does.
+class FrameCapture
+{
+public:
+	enum class Format {
+		// One PNG per frame, numbered from 0
+		PngSequence,
+		// Frames back to back as 8-bit RGB rows, to a file or to a "|command" pipe
+		RawVideo
+	};
+
+	// Readbacks in flight, the GPU copies one frame while older ones are mapped
+	static constexpr int RingSize = 3;
+	// Frames waiting for the writer before new ones are dropped
+	static constexpr int QueueCapacity = 8;
+
+private:
+	struct Frame {
+		std::vector<uint8_t> rgb;
+		int index;
+	};
+
+	static inline Format format = Format::PngSequence;
+	static inline std::string outputPath;
+	static inline bool capturing = false;
+	static inline bool keepEveryFrame = false;
+	// Size of the captured frames, taken from the first frame
+	static inline int width = 0;
+	static inline int height = 0;
+
+	static inline GLuint packBuffers[RingSize] = {};
+	static inline GLsync packFences[RingSize] = {};
+	// Slot the next readback goes into, and how many slots before it are still in flight
+	static inline int nextSlot = 0;
+	static inline int pendingSlots = 0;
+	static inline int nextFrameIndex = 0;
+
+	static inline std::thread writer;
+	static inline std::mutex queueMutex;
+	// Signaled when a frame is queued or the writer should stop
+	static inline std::condition_variable frameQueued;
+	// Signaled when the writer takes a frame off the queue
+	static inline std::condition_variable frameTaken;
+	static inline std::deque<Frame> queue;
+	// Pixel vectors of written frames, reused so capturing does not allocate per frame
+	static inline std::vector<std::vector<uint8_t>> freeBuffers;
+	static inline bool stopWriter = false;
+
+	// Raw video output, a file or the pipe of a started command
+	static inline FILE* rawOutput = nullptr;
+	static inline bool rawIsPipe = false;
+
+	static inline std::atomic<int> queueDepth = 0;
+	static inline std::atomic<int> droppedFrames = 0;
+	static inline std::atomic<int> writtenFrames = 0;
+
+	static void CreateBuffers();
+	static void DeleteBuffers();
+	// Map the buffer of the oldest readback, queue its pixels and free the slot.
+	// Without wait it returns false if that readback has not finished yet.
+	static bool FinishOldest(bool wait);
+	// Copy bottom-up rows from GL into a top-down frame for the writer
+	static void Enqueue(const uint8_t* pixels);
+	static void WriterLoop();
+	static bool WriteFrame(const Frame& frame);
+
+public:
+	// Begin capturing to path: a file prefix for PNG sequences, a file or "|command" for raw video.
+	// With keepEveryFrame the frame loop waits instead of dropping frames.
+	static bool Start(const std::string& path, Format format, bool keepEveryFrame = false);
+	// Queue a readback of the bound read framebuffer. Call once per frame, after drawing.
+	static void CaptureFrame(int frameWidth, int frameHeight);
+	// Finish the readbacks in flight, write every queued frame and close the output
+	static void Stop();
+
+	static bool IsCapturing() { return capturing; }
+	static Format GetFormat() { return format; }
+	static const char* FormatName(Format format);
+
+	// Frames waiting for the writer, and frames written or dropped since Start
+	static int QueueDepth() { return queueDepth.load(std::memory_order_relaxed); }
+	static int WrittenFrames() { return writtenFrames.load(std::memory_order_relaxed); }
+	static int DroppedFrames() { return droppedFrames.load(std::memory_order_relaxed); }
+
+	// Write tightly packed top-down RGB rows as a PNG with stored deflate blocks
+	static bool WritePng(const std::string& path, const uint8_t* rgb, int width, int height);
+};
@@ -0,0 +1,688 @@
+#include "GridRenderer.h"
+#include "sim/Material.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+
+void GridRenderer::Init(GLuint textureShader, GLuint instancedShader, int width, int height)
+{
+    SetPrograms(textureShader, instancedShader);
+
+    glGenTextures(1, &cellTexture);
+    glBindTexture(GL_TEXTURE_2D, cellTexture);
+
+    // Integer textures cannot be filtered, every texel is read with texelFetch.
+    // The mipmap filter only makes the levels above 0 part of the texture.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    Resize(width, height);
+
+    // Start on the fastest path this context offers
+    SetUploadPath(UploadPath::Persistent);
+
+    // Instanced mode draws a unit quad per cell, the corners use the same layout as the full-screen quad
+    const float corners[] = {
+         1.0f,  1.0f,
+         1.0f, -1.0f,
+        -1.0f,  1.0f,
+        -1.0f, -1.0f
+    };
+
+    glGenVertexArrays(1, &instanceVao);
+    glBindVertexArray(instanceVao);
+
+    glGenBuffers(1, &quadBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, quadBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+
+    // Per instance: the cell position as two shorts and the raw cell byte, read as integers
+    glGenBuffers(1, &instanceBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    glVertexAttribIPointer(1, 2, GL_UNSIGNED_SHORT, sizeof(CellInstance), (void*)offsetof(CellInstance, x));
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(1);
+    glVertexAttribIPointer(2, 1, GL_UNSIGNED_BYTE, sizeof(CellInstance), (void*)offsetof(CellInstance, cell));
+    glVertexAttribDivisor(2, 1);
+    glEnableVertexAttribArray(2);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+void GridRenderer::SetPrograms(GLuint textureShader, GLuint instancedShader)
+{
+    textureProgram = textureShader;
+    instancedProgram = instancedShader;
+
+    textureUniforms = InitUniforms(textureProgram);
+    instancedUniforms = InitUniforms(instancedProgram);
+}
+
+GridRenderer::ProgramUniforms GridRenderer::InitUniforms(GLuint program)
+{
+    glUseProgram(program);
+
+    // The cell texture always sits on unit 0
+    glUniform1i(glGetUniformLocation(program, "cells"), 0);
+
+    // Upload the palette once, it never changes at runtime
+    for (int i = 0; i < ElementTypeCount; ++i) {
+        std::string name = "palette[" + std::to_string(i) + "]";
+        const Color& color = materials[i].color;
+        glUniform3f(glGetUniformLocation(program, name.c_str()), color.r, color.g, color.b);
+    }
+
+    ProgramUniforms uniforms;
+    uniforms.view = glGetUniformLocation(program, "view");
+    uniforms.level = glGetUniformLocation(program, "level");
+
+    glUseProgram(0);
+    return uniforms;
+}
+
+void GridRenderer::SetViewUniform(GLint location)
+{
+    if (viewWidth <= 0.0f) {
+        glUniform4f(location, 0.0f, 0.0f, static_cast<float>(textureWidth), static_cast<float>(textureHeight));
+    }
+    else {
+        glUniform4f(location, viewX, viewY, viewWidth, viewHeight);
+    }
+}
+
+void GridRenderer::Resize(int width, int height)
+{
+    if (width == textureWidth && height == textureHeight) return;
+
+    textureWidth = width;
+    textureHeight = height;
+
+    // Stop before a level would be less than one texel across
+    levelCount = 1;
+    while (levelCount < MaxLevels && (std::min(width, height) >> levelCount) > 0) {
+        ++levelCount;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, cellTexture);
+    for (int level = 0; level < levelCount; ++level) {
+        glTexImage2D(GL_TEXTURE_2D, level, GL_R8UI, LevelWidth(level), LevelHeight(level), 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    levels.resize(levelCount - 1);
+    for (int level = 1; level < levelCount; ++level) {
+        levels[level - 1].assign(static_cast<size_t>(LevelWidth(level)) * LevelHeight(level), 0);
+    }
+
+    // Every level is undefined, so every chunk is stale until it has been in view at that level
+    chunksX = (width + Grid::ChunkSize - 1) / Grid::ChunkSize;
+    chunksY = (height + Grid::ChunkSize - 1) / Grid::ChunkSize;
+    staleRects.assign(static_cast<size_t>(chunksX) * chunksY, DirtyRect());
+    staleLevels.assign(static_cast<size_t>(chunksX) * chunksY, 0);
+    MarkAllStale();
+
+    // The ring buffers hold one whole grid each
+    if (uploadPath != UploadPath::Direct) {
+        DeleteRing();
+        CreateRing();
+    }
+}
+
+void GridRenderer::SetView(float x, float y, float width, float height, int newViewportWidth, int newViewportHeight)
+{
+    viewX = x;
+    viewY = y;
+    viewWidth = width;
+    viewHeight = height;
+    viewportWidth = newViewportWidth;
+    viewportHeight = newViewportHeight;
+}
+
+void GridRenderer::Upload(Grid& grid)
+{
+    Resize(grid.Width(), grid.Height());
+
+    // Every level has to hear about every change, whichever of them is drawn this frame
+    uploadRects.clear();
+    grid.TakeChangedRects(uploadRects);
+    for (const DirtyRect& rect : uploadRects) {
+        MarkStale(rect);
+    }
+
+    activeLevel = ChooseLevel();
+
+    DrawMode mode = drawMode;
+    if (mode == DrawMode::Auto) {
+        // Two thresholds so a fill ratio sitting right on one does not flip modes every frame.
+        // Past level 0 the texture costs at most a few bytes per pixel, instances can cost far more.
+        double fill = grid.FillRatio();
+        if (activeLevel > 0) {
+            mode = DrawMode::Texture;
+        }
+        else if (activeMode == DrawMode::Texture) {
+            mode = fill < InstancedEnterRatio ? DrawMode::Instanced : DrawMode::Texture;
+        }
+        else {
+            mode = fill > InstancedLeaveRatio ? DrawMode::Texture : DrawMode::Instanced;
+        }
+    }
+    activeMode = mode;
+
+    if (activeMode == DrawMode::Instanced) {
+        UploadInstances(grid);
+    }
+    else {
+        UploadTexture(grid);
+    }
+}
+
+void GridRenderer::UploadInstances(Grid& grid)
+{
+    // Changes stay marked stale for the texture until it is drawn again
+    DirtyRect visible = VisibleCells();
+    grid.CollectInstances(instances, visible.minX, visible.minY, visible.maxX, visible.maxY);
+
+    // Orphan the old storage so the driver never waits for the previous frame's draw
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(CellInstance), nullptr, GL_STREAM_DRAW);
+    if (!instances.empty()) {
+        glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(CellInstance), instances.data());
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    lastUploadBytes = instances.size() * sizeof(CellInstance);
+    lastUploadCalls = 1;
+}
+
+void GridRenderer::UploadTexture(Grid& grid)
+{
+    TakeVisibleStaleRects(activeLevel);
+
+    auto area = [](const DirtyRect& rect) {
+        return static_cast<size_t>(rect.maxX - rect.minX) * (rect.maxY - rect.minY);
+    };
+
+    DirtyRect bounds;
+    lastUploadBytes = 0;
+    for (const DirtyRect& rect : uploadRects) {
+        lastUploadBytes += area(rect);
+        bounds.Include(rect.minX, rect.minY, rect.maxX, rect.maxY);
+    }
+
+    // Past half of their bounding box one big upload beats many small ones
+    if (!uploadRects.empty() && lastUploadBytes * 2 > area(bounds))
+    {
+        uploadRects.clear();
+        uploadRects.push_back(bounds);
+        lastUploadBytes = area(bounds);
+    }
+    else
+    {
+        // Stale rects come one per block of whole chunks, a texel never straddles two blocks
+        int blockCells = std::max(Grid::ChunkSize, 1 << activeLevel);
+        MergeRects(uploadRects, blockCells >> activeLevel);
+
+        // Merging covers the slack between rects too, the packed size is only known now
+        lastUploadBytes = 0;
+        for (const DirtyRect& rect : uploadRects) {
+            lastUploadBytes += area(rect);
+        }
+    }
+
+    lastUploadCalls = static_cast<int>(uploadRects.size());
+    if (uploadRects.empty()) return;
+
+    if (activeLevel == 0)
+    {
+        UploadRects(0, reinterpret_cast<const uint8_t*>(grid.Data()), grid.Stride());
+    }
+    else
+    {
+        for (const DirtyRect& rect : uploadRects) {
+            BuildLevel(grid, activeLevel, rect);
+        }
+        UploadRects(activeLevel, levels[activeLevel - 1].data(), LevelWidth(activeLevel));
+    }
+}
+
+void GridRenderer::UploadRects(int level, const uint8_t* source, int stride)
+{
+    // Rows are tightly packed bytes
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_2D, cellTexture);
+
+    if (uploadPath == UploadPath::Direct)
+    {
+        // Read each rect straight out of the source rows
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, stride);
+        for (const DirtyRect& rect : uploadRects) {
+            glTexSubImage2D(GL_TEXTURE_2D, level, rect.minX, rect.minY, rect.maxX - rect.minX, rect.maxY - rect.minY,
+                GL_RED_INTEGER, GL_UNSIGNED_BYTE, source + static_cast<size_t>(rect.minY) * stride + rect.minX);
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+    else
+    {
+        int index = ringIndex;
+        ringIndex = (ringIndex + 1) % RingSize;
+
+        // With RingSize buffers in flight this only blocks when the GPU is several frames behind
+        WaitForBuffer(index);
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ringBuffers[index]);
+
+        uint8_t* target = nullptr;
+        size_t mappedBytes = 0;
+        if (uploadPath == UploadPath::Persistent)
+        {
+            // Coherent mapping, the copy is visible to the GPU without a flush
+            target = static_cast<uint8_t*>(ringMapped[index]);
+            mappedBytes = ringBufferSize;
+        }
+        else
+        {
+            // The fence already proved the GPU is done with this buffer, so skip the driver's own sync
+            target = static_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, lastUploadBytes,
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+            mappedBytes = lastUploadBytes;
+        }
+
+        // The rects are disjoint, so packed one after another they never outgrow a whole grid
+        if (target)
+        {
+            size_t offset = 0;
+            for (const DirtyRect& rect : uploadRects) {
+                size_t rowBytes = rect.maxX - rect.minX;
+                for (int y = rect.minY; y < rect.maxY; ++y) {
+                    assert(offset + rowBytes <= mappedBytes);
+                    std::memcpy(target + offset, source + static_cast<size_t>(y) * stride + rect.minX, rowBytes);
+                    offset += rowBytes;
+                }
+            }
+        }
+
+        if (uploadPath == UploadPath::PixelBuffers) {
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+
+        // Sources from the bound unpack buffer, the calls return before the GPU copies anything
+        size_t offset = 0;
+        for (const DirtyRect& rect : uploadRects) {
+            glTexSubImage2D(GL_TEXTURE_2D, level, rect.minX, rect.minY, rect.maxX - rect.minX, rect.maxY - rect.minY,
+                GL_RED_INTEGER, GL_UNSIGNED_BYTE, reinterpret_cast<const void*>(offset));
+            offset += static_cast<size_t>(rect.maxX - rect.minX) * (rect.maxY - rect.minY);
+        }
+
+        ringFences[index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+int GridRenderer::ChooseLevel()
+{
+    if (viewWidth <= 0.0f || viewportWidth <= 0 || viewportHeight <= 0) return 0;
+
+    // Each level halves the cells per pixel, stop while every pixel still gets its own texel
+    double cellsPerPixel = std::max(viewWidth / viewportWidth, viewHeight / viewportHeight);
+    int level = 0;
+    while (level + 1 < levelCount && cellsPerPixel >= 2.0) {
+        cellsPerPixel *= 0.5;
+        ++level;
+    }
+    return level;
+}
+
+DirtyRect GridRenderer::VisibleCells()
+{
+    if (viewWidth <= 0.0f) return { 0, 0, textureWidth, textureHeight };
+
+    DirtyRect visible;
+    visible.minX = std::max(0, static_cast<int>(std::floor(viewX)));
+    visible.minY = std::max(0, static_cast<int>(std::floor(viewY)));
+    visible.maxX = std::min(textureWidth, static_cast<int>(std::ceil(viewX + viewWidth)));
+    visible.maxY = std::min(textureHeight, static_cast<int>(std::ceil(viewY + viewHeight)));
+    return visible;
+}
+
+void GridRenderer::MarkStale(const DirtyRect& rect)
+{
+    if (rect.Empty()) return;
+
+    size_t index = static_cast<size_t>(rect.minY / Grid::ChunkSize) * chunksX + rect.minX / Grid::ChunkSize;
+    staleRects[index].Include(rect.minX, rect.minY, rect.maxX, rect.maxY);
+    staleLevels[index] = static_cast<uint16_t>((1 << levelCount) - 1);
+}
+
+void GridRenderer::MarkAllStale()
+{
+    for (int cy = 0; cy < chunksY; ++cy) {
+        for (int cx = 0; cx < chunksX; ++cx) {
+            DirtyRect rect;
+            rect.Include(cx * Grid::ChunkSize, cy * Grid::ChunkSize,
+                std::min((cx + 1) * Grid::ChunkSize, textureWidth), std::min((cy + 1) * Grid::ChunkSize, textureHeight));
+            MarkStale(rect);
+        }
+    }
+}
+
+void GridRenderer::TakeVisibleStaleRects(int level)
+{
+    uploadRects.clear();
+
+    DirtyRect visible = VisibleCells();
+    if (visible.Empty()) return;
+
+    // Blocks are whole chunks and whole texels of the level, so each texel belongs to exactly one block
+    const int blockChunks = std::max(1, (1 << level) / Grid::ChunkSize);
+    const uint16_t bit = static_cast<uint16_t>(1 << level);
+    const int scale = 1 << level;
+
+    int firstX = visible.minX / Grid::ChunkSize / blockChunks * blockChunks;
+    int firstY = visible.minY / Grid::ChunkSize / blockChunks * blockChunks;
+    int endX = (visible.maxX + Grid::ChunkSize - 1) / Grid::ChunkSize;
+    int endY = (visible.maxY + Grid::ChunkSize - 1) / Grid::ChunkSize;
+
+    for (int by = firstY; by < endY; by += blockChunks) {
+        for (int bx = firstX; bx < endX; bx += blockChunks) {
+            DirtyRect stale;
+            for (int cy = by; cy < std::min(by + blockChunks, chunksY); ++cy) {
+                for (int cx = bx; cx < std::min(bx + blockChunks, chunksX); ++cx) {
+                    size_t index = static_cast<size_t>(cy) * chunksX + cx;
+                    if ((staleLevels[index] & bit) == 0) continue;
+
+                    const DirtyRect& rect = staleRects[index];
+                    stale.Include(rect.minX, rect.minY, rect.maxX, rect.maxY);
+
+                    // The rect is kept until the last level has taken it
+                    staleLevels[index] &= static_cast<uint16_t>(~bit);
+                    if (staleLevels[index] == 0) staleRects[index].Reset();
+                }
+            }
+            if (stale.Empty()) continue;
+
+            // Texels touching a stale cell. Cells past the last whole texel of a row or column have no texel.
+            DirtyRect texels;
+            texels.minX = stale.minX >> level;
+            texels.minY = stale.minY >> level;
+            texels.maxX = std::min((stale.maxX + scale - 1) >> level, LevelWidth(level));
+            texels.maxY = std::min((stale.maxY + scale - 1) >> level, LevelHeight(level));
+            if (!texels.Empty()) uploadRects.push_back(texels);
+        }
+    }
+}
+
+void GridRenderer::BuildLevel(const Grid& grid, int level, const DirtyRect& rect)
+{
+    // Each texel takes the first filled one of its four source texels when at least two are filled,
+    // so sparse grains fade out instead of turning whole blocks into sand
+    auto reduce = [](uint8_t a, uint8_t b, uint8_t c, uint8_t d) -> uint8_t {
+        int filled = ((a & Element::TypeMask) != 0) + ((b & Element::TypeMask) != 0) +
+                     ((c & Element::TypeMask) != 0) + ((d & Element::TypeMask) != 0);
+        if (filled < 2) return 0;
+        if (a & Element::TypeMask) return a;
+        if (b & Element::TypeMask) return b;
+        if (c & Element::TypeMask) return c;
+        return d;
+    };
+
+    for (int k = 1; k <= level; ++k) {
+        // The same area in level k texels
+        int shift = level - k;
+        int x0 = rect.minX << shift;
+        int y0 = rect.minY << shift;
+        int x1 = std::min(rect.maxX << shift, LevelWidth(k));
+        int y1 = std::min(rect.maxY << shift, LevelHeight(k));
+
+        const uint8_t* source = k == 1 ? reinterpret_cast<const uint8_t*>(grid.Data()) : levels[k - 2].data();
+        size_t sourceStride = k == 1 ? grid.Stride() : LevelWidth(k - 1);
+        uint8_t* target = levels[k - 1].data();
+        size_t targetStride = LevelWidth(k);
+
+        for (int y = y0; y < y1; ++y) {
+            const uint8_t* top = source + 2 * y * sourceStride;
+            const uint8_t* bottom = top + sourceStride;
+            uint8_t* row = target + y * targetStride;
+            for (int x = x0; x < x1; ++x) {
+                row[x] = reduce(top[2 * x], top[2 * x + 1], bottom[2 * x], bottom[2 * x + 1]);
+            }
+        }
+    }
+}
+
+void GridRenderer::MergeRects(std::vector<DirtyRect>& rects, int blockSize)
+{
+    auto area = [](const DirtyRect& rect) {
+        return static_cast<int64_t>(rect.maxX - rect.minX) * (rect.maxY - rect.minY);
+    };
+
+    // Rects arrive one per block in row-major order, so neighbors within a block row are consecutive
+    size_t count = 0;
+    for (size_t i = 0; i < rects.size(); ++i) {
+        if (count > 0) {
+            DirtyRect& last = rects[count - 1];
+            const DirtyRect& rect = rects[i];
+
+            bool sameBlockRow = last.minY / blockSize == rect.minY / blockSize;
+            bool nextBlock = rect.minX / blockSize == (last.maxX - 1) / blockSize + 1;
+
+            if (sameBlockRow && nextBlock) {
+                DirtyRect merged = last;
+                merged.Include(rect.minX, rect.minY, rect.maxX, rect.maxY);
+                if (area(merged) <= area(last) + area(rect) + MergeSlack) {
+                    last = merged;
+                    continue;
+                }
+            }
+        }
+        rects[count++] = rects[i];
+    }
+    rects.resize(count);
+
+    // Stack rects that cover exactly the same columns and touch vertically.
+    // Block rows arrive top to bottom, so the rect to extend is the last one seen with those columns.
+    std::unordered_map<uint64_t, size_t> lastWithColumns;
+    count = 0;
+    for (size_t i = 0; i < rects.size(); ++i) {
+        const DirtyRect rect = rects[i];
+        uint64_t columns = (static_cast<uint64_t>(rect.minX) << 32) | static_cast<uint32_t>(rect.maxX);
+
+        auto found = lastWithColumns.find(columns);
+        if (found != lastWithColumns.end() && rects[found->second].maxY == rect.minY) {
+            rects[found->second].maxY = rect.maxY;
+            continue;
+        }
+
+        lastWithColumns[columns] = count;
+        rects[count++] = rect;
+    }
+    rects.resize(count);
+}
+
+void GridRenderer::Draw(GLuint vao)
+{
+    if (activeMode == DrawMode::Instanced)
+    {
+        if (instances.empty()) return;
+
+        glUseProgram(instancedProgram);
+        SetViewUniform(instancedUniforms.view);
+
+        glBindVertexArray(instanceVao);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(instances.size()));
+    }
+    else
+    {
+        glUseProgram(textureProgram);
+        SetViewUniform(textureUniforms.view);
+        glUniform1i(textureUniforms.level, activeLevel);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, cellTexture);
+
+        glBindVertexArray(vao);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+void GridRenderer::Cleanup()
+{
+    DeleteRing();
+
+    glDeleteVertexArrays(1, &instanceVao);
+    glDeleteBuffers(1, &quadBuffer);
+    glDeleteBuffers(1, &instanceBuffer);
+    instanceVao = 0;
+    quadBuffer = 0;
+    instanceBuffer = 0;
+
+    glDeleteTextures(1, &cellTexture);
+    cellTexture = 0;
+    textureWidth = 0;
+    textureHeight = 0;
+}
+
+bool GridRenderer::IsSupported(UploadPath path)
+{
+    switch (path)
+    {
+    case UploadPath::Persistent:
+        return GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+    case UploadPath::PixelBuffers:
+        // Fences and map ranges are core in 3.2, pixel buffers in 2.1
+        return GLEW_VERSION_3_2 || (GLEW_ARB_pixel_buffer_object && GLEW_ARB_sync && GLEW_ARB_map_buffer_range);
+    default:
+        return true;
+    }
+}
+
+void GridRenderer::SetUploadPath(UploadPath path)
+{
+    // Fall back one step at a time until something works
+    if (path == UploadPath::Persistent && !IsSupported(path)) path = UploadPath::PixelBuffers;
+    if (path == UploadPath::PixelBuffers && !IsSupported(path)) path = UploadPath::Direct;
+
+    if (path == uploadPath && (path == UploadPath::Direct || ringBuffers[0] != 0)) return;
+
+    DeleteRing();
+    uploadPath = path;
+    if (uploadPath != UploadPath::Direct) {
+        CreateRing();
+    }
+}
+
+const char* GridRenderer::DrawModeName(DrawMode mode)
+{
+    switch (mode)
+    {
+    case DrawMode::Texture:   return "Cell texture";
+    case DrawMode::Instanced: return "Instanced";
+    default:                  return "Auto";
+    }
+}
+
+const char* GridRenderer::UploadPathName(UploadPath path)
+{
+    switch (path)
+    {
+    case UploadPath::PixelBuffers: return "Pixel buffer ring";
+    case UploadPath::Persistent:   return "Persistent mapped";
+    default:                       return "Direct";
+    }
+}
+
+void GridRenderer::CreateRing()
+{
+    ringBufferSize = static_cast<size_t>(textureWidth) * textureHeight;
+    ringIndex = 0;
+
+    glGenBuffers(RingSize, ringBuffers);
+
+    for (int i = 0; i < RingSize; ++i) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ringBuffers[i]);
+
+        if (uploadPath == UploadPath::Persistent)
+        {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_PIXEL_UNPACK_BUFFER, ringBufferSize, nullptr, flags);
+            ringMapped[i] = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, ringBufferSize, flags);
+        }
+        else
+        {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, ringBufferSize, nullptr, GL_STREAM_DRAW);
+        }
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    // A failed persistent map leaves nothing to write into, plain pixel buffers still work
+    if (uploadPath == UploadPath::Persistent) {
+        for (int i = 0; i < RingSize; ++i) {
+            if (ringMapped[i] == nullptr) {
+                std::cerr << "Persistent mapping failed, falling back to pixel buffers" << std::endl;
+                DeleteRing();
+                uploadPath = UploadPath::PixelBuffers;
+                CreateRing();
+                return;
+            }
+        }
+    }
+}
+
+void GridRenderer::DeleteRing()
+{
+    if (ringBuffers[0] == 0) return;
+
+    for (int i = 0; i < RingSize; ++i) {
+        WaitForBuffer(i);
+
+        if (ringMapped[i]) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ringBuffers[i]);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            ringMapped[i] = nullptr;
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    glDeleteBuffers(RingSize, ringBuffers);
+    for (int i = 0; i < RingSize; ++i) {
+        ringBuffers[i] = 0;
+    }
+    ringBufferSize = 0;
+}
+
+void GridRenderer::WaitForBuffer(int index)
+{
+    if (ringFences[index] == nullptr) return;
+
+    // Flush on the first wait so the fence is guaranteed to signal
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    while (true) {
+        GLenum result = glClientWaitSync(ringFences[index], flags, 1000000);
+        if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED) break;
+        flags = 0;
+    }
+
+    glDeleteSync(ringFences[index]);
+    ringFences[index] = nullptr;
+}
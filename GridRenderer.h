@@ -0,0 +1,171 @@
+#pragma once
+#include "sim/Grid.h"
+#include <GL/glew.h>
+#include <vector>
+
+
+// Draws the visible part of the grid in one draw call, in one of two ways.
+// Texture mode uploads the cells as an R8UI texture holding the raw Element bytes and draws a
+// full-screen quad whose fragment shader turns them into colors through the material palette.
+// Instanced mode uploads one CellInstance per non-air cell and draws a quad per instance,
+// which moves far fewer bytes when the grid is mostly air.
+// When more cells than pixels are in view the texture is drawn from a coarser mip level, built on
+// the CPU by halving the level below, and only the chunks in view are brought up to date in it.
+class GridRenderer
+{
+public:
+	enum class DrawMode {
+		// Pick per frame from the grid's fill ratio
+		Auto,
+		Texture,
+		Instanced
+	};
+
+	// How cell bytes get from the grid into the texture
+	enum class UploadPath {
+		// Plain glTexSubImage2D from client memory, the driver copies before returning
+		Direct,
+		// Ring of pixel unpack buffers, mapped unsynchronized and guarded by fences
+		PixelBuffers,
+		// Ring of buffers mapped once with GL_ARB_buffer_storage and written in place
+		Persistent
+	};
+
+	// Buffers in the ring, the CPU fills one while the GPU still reads the others
+	static constexpr int RingSize = 3;
+	// Two neighboring rects are uploaded as one when that costs at most this many extra bytes
+	static constexpr int MergeSlack = Grid::ChunkSize * Grid::ChunkSize;
+	// Auto switches to instances when fewer cells than this are filled, and back above the
+	// second ratio. An instance is 8 bytes, so at 2% it is still at most a sixth of a full upload.
+	static constexpr double InstancedEnterRatio = 0.02;
+	static constexpr double InstancedLeaveRatio = 0.04;
+	// Levels of detail at most, level L has one texel per 2^L x 2^L cells
+	static constexpr int MaxLevels = 9;
+
+private:
+	// Uniform locations of one program, looked up once when the program is set
+	struct ProgramUniforms {
+		GLint view;
+		GLint level;
+	};
+
+	static inline GLuint textureProgram = 0;
+	static inline GLuint instancedProgram = 0;
+
+	static inline DrawMode drawMode = DrawMode::Auto;
+	// Texture or Instanced, what the last Upload prepared
+	static inline DrawMode activeMode = DrawMode::Texture;
+
+	static inline GLuint cellTexture = 0;
+	static inline int textureWidth = 0;
+	static inline int textureHeight = 0;
+	static inline int levelCount = 1;
+	// Level the last Upload brought up to date and Draw samples
+	static inline int activeLevel = 0;
+	// CPU copy of every level above 0, levels[L - 1] holds level L in rows of LevelWidth(L) bytes
+	static inline std::vector<std::vector<uint8_t>> levels;
+
+	// Per grid chunk, in row-major order: the cells changed since some level last received them,
+	// and one bit per level that is still missing them
+	static inline std::vector<DirtyRect> staleRects;
+	static inline std::vector<uint16_t> staleLevels;
+	static inline int chunksX = 0;
+	static inline int chunksY = 0;
+
+	// Visible part of the grid in cells, a width of 0 means all of it, and the pixels it is drawn on
+	static inline float viewX = 0.0f;
+	static inline float viewY = 0.0f;
+	static inline float viewWidth = 0.0f;
+	static inline float viewHeight = 0.0f;
+	static inline int viewportWidth = 0;
+	static inline int viewportHeight = 0;
+
+	// Rects sent by the last Upload, reused between frames
+	static inline std::vector<DirtyRect> uploadRects;
+	static inline size_t lastUploadBytes = 0;
+	static inline int lastUploadCalls = 0;
+
+	// Quad corners and the per-instance cells for instanced mode
+	static inline GLuint instanceVao = 0;
+	static inline GLuint quadBuffer = 0;
+	static inline GLuint instanceBuffer = 0;
+	static inline std::vector<CellInstance> instances;
+
+	static inline UploadPath uploadPath = UploadPath::Direct;
+	static inline GLuint ringBuffers[RingSize] = {};
+	static inline GLsync ringFences[RingSize] = {};
+	// Write pointers of the persistent buffers, null on the other paths
+	static inline void* ringMapped[RingSize] = {};
+	static inline size_t ringBufferSize = 0;
+	static inline int ringIndex = 0;
+
+	static inline ProgramUniforms textureUniforms = { -1, -1 };
+	static inline ProgramUniforms instancedUniforms = { -1, -1 };
+
+	// Bind the texture unit, upload the palette and look up the per-frame uniforms of either program
+	static ProgramUniforms InitUniforms(GLuint program);
+	// Set the view uniform, the visible cells as (x, y, width, height)
+	static void SetViewUniform(GLint location);
+	static void UploadTexture(Grid& grid);
+	static void UploadInstances(Grid& grid);
+	// Send uploadRects, in level coordinates, from rows of stride bytes to a texture level
+	static void UploadRects(int level, const uint8_t* source, int stride);
+
+	static int LevelWidth(int level) { return textureWidth >> level; }
+	static int LevelHeight(int level) { return textureHeight >> level; }
+	// Coarsest level that still has a texel for every pixel of the viewport
+	static int ChooseLevel();
+	// Visible cells, widened to whole cells
+	static DirtyRect VisibleCells();
+	// Record changed cells for every level, rect must lie inside one chunk
+	static void MarkStale(const DirtyRect& rect);
+	static void MarkAllStale();
+	// Move the stale cells of the visible chunks into uploadRects in level coordinates, and clear them for level
+	static void TakeVisibleStaleRects(int level);
+	// Recompute the texels of rect in level coordinates from the grid, through every level in between
+	static void BuildLevel(const Grid& grid, int level, const DirtyRect& rect);
+
+	static void CreateRing();
+	static void DeleteRing();
+	// Block until the GPU is done reading ring buffer index
+	static void WaitForBuffer(int index);
+	// Join side by side rects of neighboring blocks, then stacked rects with the same columns.
+	// The rects must come at most one per blockSize x blockSize block, in row-major block order.
+	static void MergeRects(std::vector<DirtyRect>& rects, int blockSize);
+
+public:
+	// Create the cell texture and instance buffers, and upload the palette uniforms of both programs
+	static void Init(GLuint textureShader, GLuint instancedShader, int width, int height);
+	// Use new programs from the next Draw on, for example after a shader reload
+	static void SetPrograms(GLuint textureShader, GLuint instancedShader);
+	// Reallocate the cell texture and its levels for a new grid size
+	static void Resize(int width, int height);
+	// Show the cells [x, x + width) x [y, y + height) on a viewport of the given size from the next Upload on
+	static void SetView(float x, float y, float width, float height, int viewportWidth, int viewportHeight);
+	// Pick the draw mode and level of detail for this frame and send the visible grid to the GPU.
+	// In texture mode only the cells the grid reports as changed are copied, changes outside the
+	// view wait until they come into view. Either way those reports are collected.
+	static void Upload(Grid& grid);
+	// Draw what the last Upload sent, the VAO must hold a full-screen triangle strip
+	static void Draw(GLuint vao);
+	static void Cleanup();
+
+	// Whether the current context has the extensions path needs
+	static bool IsSupported(UploadPath path);
+	// Switch upload paths, unsupported paths fall back to Direct
+	static void SetUploadPath(UploadPath path);
+	static UploadPath GetUploadPath() { return uploadPath; }
+	static const char* UploadPathName(UploadPath path);
+
+	static void SetDrawMode(DrawMode mode) { drawMode = mode; }
+	static DrawMode GetDrawMode() { return drawMode; }
+	// Texture or Instanced, the mode Auto settled on for this frame
+	static DrawMode ActiveDrawMode() { return activeMode; }
+	static const char* DrawModeName(DrawMode mode);
+	// Level of detail of the last Upload, 0 draws every cell
+	static int ActiveLevel() { return activeLevel; }
+
+	// Bytes and buffer or texture update calls of the last Upload
+	static size_t LastUploadBytes() { return lastUploadBytes; }
+	static int LastUploadCalls() { return lastUploadCalls; }
+};
@@ -0,0 +1,31 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstdint>
+#include <vector>
+
+
+// Offscreen OpenGL for machines without a display or GPU.
+// On Linux the context comes from EGL on the Mesa surfaceless platform, which runs on llvmpipe,
+// elsewhere from a hidden GLFW window. Frames are drawn into a framebuffer object.
+class Headless
+{
+private:
+	static inline GLuint framebuffer = 0;
+	static inline GLuint colorBuffer = 0;
+	static inline int width = 0;
+	static inline int height = 0;
+
+	// EGLDisplay and EGLContext on Linux, the hidden GLFWwindow elsewhere
+	static inline void* display = nullptr;
+	static inline void* context = nullptr;
+
+public:
+	// Create a GL 3.3 core context and make it current. Logs and returns false on failure.
+	static bool CreateContext();
+	// Create a width x height RGBA8 framebuffer, bind it and set the viewport to it
+	static bool CreateFramebuffer(int width, int height);
+	// Read the framebuffer back as tightly packed RGBA rows, bottom row first
+	static void ReadPixels(std::vector<uint8_t>& rgba);
+	// Release the framebuffer and the context
+	static void Destroy();
+};
@@ -1,7 +1,15 @@
+#include "Camera.h"
+#include "FrameCapture.h"
+#include "GridRenderer.h"
 #include "IMGui.h"
+#include "sim/Material.h"
+#include "sim/Simulation.h"
+#include "sim/SimulationThread.h"
+#include "sim/SandKernel.h"
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include <GLFW/glfw3.h>
+#include <string>
 
 
 
@@ -102,6 +110,48 @@ void IMGui::RenderControlsWindow(int& GRID_WIDTH, int& GRID_HEIGHT)
     //Create Grid Size combo box
     SetWindowSizeComboBox(GRID_WIDTH, GRID_HEIGHT);
 
+    //Create brush material combo box
+    SetBrushComboBox();
+
+    //Create simulation thread slider
+    SetThreadCountSlider();
+
+    //Create tick rate slider
+    SetTickRateSlider();
+
+    //Create turbo controls
+    SetTurboControls();
+
+    //Create simulation engine combo box
+    SetEngineComboBox();
+
+    bool doubleBuffered = Simulation::IsDoubleBuffered();
+    if (ImGui::Checkbox("Double buffered", &doubleBuffered))
+    {
+        SimulationThread::Post([=](Grid&) { Simulation::SetDoubleBuffered(doubleBuffered); });
+    }
+
+    bool worklist = Simulation::IsWorklistEnabled();
+    if (ImGui::Checkbox("Active cell worklist", &worklist))
+    {
+        SimulationThread::Post([=](Grid&) { Simulation::SetWorklist(worklist); });
+    }
+
+    //Create texture upload combo box
+    SetUploadPathComboBox();
+
+    //Create draw mode combo box
+    SetDrawModeComboBox();
+
+    // Scroll zooms and the middle mouse button pans
+    if (ImGui::Button("Reset View"))
+    {
+        Camera::Reset();
+    }
+
+    //Create frame capture controls
+    SetCaptureControls();
+
     // Debugging: Show IO values
     ImGuiIO& io = ImGui::GetIO();
 
@@ -120,12 +170,26 @@ void IMGui::SetWindowSizeComboBox(int& GRID_WIDTH, int& GRID_HEIGHT)
     {
         "30 x 30",
         "200 x 150",
-        "300 x 200"
+        "300 x 200",
+        "1024 x 768",
+        "2048 x 2048",
+        "4096 x 4096"
+    };
+
+    const int sizes[][2] =
+    {
+        { 30, 30 },
+        { 200, 150 },
+        { 300, 200 },
+        { 1024, 768 },
+        { 2048, 2048 },
+        { 4096, 4096 }
     };
 
     static const char* currentSize = windowSizes[2];
-    static int selectedIndex = -1;
+    static int customSize[2] = { 300, 200 };
 
+    // Only write the size when the user picks one, the grid is reallocated whenever it differs
     if (ImGui::BeginCombo("Grid Size", currentSize))
     {
         for (int i = 0; i < IM_ARRAYSIZE(windowSizes); ++i)
@@ -135,7 +199,137 @@ void IMGui::SetWindowSizeComboBox(int& GRID_WIDTH, int& GRID_HEIGHT)
             if (ImGui::Selectable(windowSizes[i], isSelected))
             {
                 currentSize = windowSizes[i];
-                selectedIndex = i;
+                GRID_WIDTH = sizes[i][0];
+                GRID_HEIGHT = sizes[i][1];
+                customSize[0] = GRID_WIDTH;
+                customSize[1] = GRID_HEIGHT;
+            }
+            if (isSelected)
+            {
+                ImGui::SetItemDefaultFocus();
+            }
+        }
+        ImGui::EndCombo();
+    }
+
+    // Any other size, for stress tests
+    ImGui::InputInt2("Custom Size", customSize);
+    ImGui::SameLine();
+    if (ImGui::Button("Apply"))
+    {
+        customSize[0] = std::clamp(customSize[0], 1, MAX_GRID_SIZE);
+        customSize[1] = std::clamp(customSize[1], 1, MAX_GRID_SIZE);
+        GRID_WIDTH = customSize[0];
+        GRID_HEIGHT = customSize[1];
+        currentSize = "Custom";
+    }
+
+    // How the existing sand is carried over
+    int mode = static_cast<int>(resizeMode);
+    ImGui::RadioButton("Crop / Pad", &mode, static_cast<int>(ResizeMode::CropOrPad));
+    ImGui::SameLine();
+    ImGui::RadioButton("Rescale", &mode, static_cast<int>(ResizeMode::Rescale));
+    resizeMode = static_cast<ResizeMode>(mode);
+}
+
+void IMGui::SetBrushComboBox()
+{
+    if (ImGui::BeginCombo("Brush", MaterialOf(brushMaterial).name))
+    {
+        // Every material but air, the right mouse button already erases
+        for (int i = 1; i < ElementTypeCount; ++i)
+        {
+            ElementType type = static_cast<ElementType>(i);
+            bool isSelected = (brushMaterial == type);
+
+            if (ImGui::Selectable(MaterialOf(type).name, isSelected))
+            {
+                brushMaterial = type;
+            }
+            if (isSelected)
+            {
+                ImGui::SetItemDefaultFocus();
+            }
+        }
+        ImGui::EndCombo();
+    }
+}
+
+void IMGui::SetThreadCountSlider()
+{
+    int maxThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    int threads = Simulation::GetThreadCount();
+
+    if (ImGui::SliderInt("Threads", &threads, 1, maxThreads))
+    {
+        SimulationThread::SetThreadCount(threads);
+    }
+}
+
+void IMGui::SetTickRateSlider()
+{
+    int rate = SimulationThread::GetTickRate();
+
+    // 0 runs ticks back to back
+    if (ImGui::SliderInt("Tick rate", &rate, 0, 1000, rate == 0 ? "Unlimited" : "%d ticks/s"))
+    {
+        SimulationThread::SetTickRate(rate);
+    }
+
+    // Ticks run at once after a slow one before the rest are dropped
+    int catchUp = SimulationThread::GetMaxCatchUp();
+    if (rate != 0 && ImGui::SliderInt("Max catch-up", &catchUp, 1, 16, "%d ticks"))
+    {
+        SimulationThread::SetMaxCatchUp(catchUp);
+    }
+}
+
+void IMGui::SetTurboControls()
+{
+    // Turbo skips drawing the ticks in between, the grid is redrawn once per budget
+    bool turbo = SimulationThread::IsTurbo();
+    if (ImGui::Checkbox("Turbo", &turbo))
+    {
+        if (turbo) SimulationThread::StartTurbo(false);
+        else SimulationThread::StopTurbo();
+    }
+
+    ImGui::SameLine();
+    if (SimulationThread::IsRunningUntilSettled())
+    {
+        ImGui::Text("Running until settled...");
+    }
+    else if (ImGui::Button("Run Until Settled"))
+    {
+        SimulationThread::StartTurbo(true);
+    }
+
+    int budget = SimulationThread::GetTurboBudget();
+    if (ImGui::SliderInt("Turbo budget", &budget, 1, 100, "%d ms per frame"))
+    {
+        SimulationThread::SetTurboBudget(budget);
+    }
+}
+
+void IMGui::SetEngineComboBox()
+{
+    const Simulation::Engine engines[] =
+    {
+        Simulation::Engine::Cells,
+        Simulation::Engine::BitPlanes
+    };
+
+    Simulation::Engine current = Simulation::GetEngine();
+
+    if (ImGui::BeginCombo("Engine", Simulation::EngineName(current)))
+    {
+        for (Simulation::Engine engine : engines)
+        {
+            bool isSelected = (current == engine);
+
+            if (ImGui::Selectable(Simulation::EngineName(engine), isSelected))
+            {
+                SimulationThread::Post([=](Grid&) { Simulation::SetEngine(engine); });
             }
             if (isSelected)
             {
@@ -145,24 +339,126 @@ void IMGui::SetWindowSizeComboBox(int& GRID_WIDTH, int& GRID_HEIGHT)
         ImGui::EndCombo();
     }
 
-    switch (selectedIndex)
+    if (current == Simulation::Engine::BitPlanes && !Simulation::IsOnBitPlanes())
+    {
+        ImGui::Text("Bit planes only run Air and Sand, this scene runs on Cells.");
+    }
+}
+
+void IMGui::SetDrawModeComboBox()
+{
+    const GridRenderer::DrawMode modes[] =
+    {
+        GridRenderer::DrawMode::Auto,
+        GridRenderer::DrawMode::Texture,
+        GridRenderer::DrawMode::Instanced
+    };
+
+    GridRenderer::DrawMode current = GridRenderer::GetDrawMode();
+
+    // Auto also shows which mode it picked this frame
+    std::string preview = GridRenderer::DrawModeName(current);
+    if (current == GridRenderer::DrawMode::Auto)
     {
-    case 0:
-        GRID_WIDTH = 30;
-        GRID_HEIGHT = 30;
-        break;
-
-    case 1:
-        GRID_WIDTH = 200;
-        GRID_HEIGHT = 150;
-        break;
-    case 2:
-        GRID_WIDTH = 300;
-        GRID_HEIGHT = 200;
-        break;
-
-    default:
-        break;
+        preview += std::string(" (") + GridRenderer::DrawModeName(GridRenderer::ActiveDrawMode()) + ")";
+    }
+
+    if (ImGui::BeginCombo("Draw mode", preview.c_str()))
+    {
+        for (GridRenderer::DrawMode mode : modes)
+        {
+            bool isSelected = (current == mode);
+
+            if (ImGui::Selectable(GridRenderer::DrawModeName(mode), isSelected))
+            {
+                GridRenderer::SetDrawMode(mode);
+            }
+            if (isSelected)
+            {
+                ImGui::SetItemDefaultFocus();
+            }
+        }
+        ImGui::EndCombo();
+    }
+}
+
+void IMGui::SetCaptureControls()
+{
+    const FrameCapture::Format formats[] =
+    {
+        FrameCapture::Format::PngSequence,
+        FrameCapture::Format::RawVideo
+    };
+
+    bool capturing = FrameCapture::IsCapturing();
+
+    // Format and path are fixed while a capture runs
+    ImGui::BeginDisabled(capturing);
+    if (ImGui::BeginCombo("Capture format", FrameCapture::FormatName(captureFormat)))
+    {
+        for (FrameCapture::Format format : formats)
+        {
+            bool isSelected = (captureFormat == format);
+
+            if (ImGui::Selectable(FrameCapture::FormatName(format), isSelected))
+            {
+                captureFormat = format;
+            }
+            if (isSelected)
+            {
+                ImGui::SetItemDefaultFocus();
+            }
+        }
+        ImGui::EndCombo();
+    }
+
+    // A file prefix for PNG frames, a file or "|command" for raw video
+    ImGui::InputText("Capture path", capturePath, sizeof(capturePath));
+    ImGui::EndDisabled();
+
+    if (ImGui::Button(capturing ? "Stop Capture" : "Start Capture"))
+    {
+        if (capturing)
+        {
+            FrameCapture::Stop();
+        }
+        else
+        {
+            FrameCapture::Start(capturePath, captureFormat);
+        }
+    }
+}
+
+void IMGui::SetUploadPathComboBox()
+{
+    const GridRenderer::UploadPath paths[] =
+    {
+        GridRenderer::UploadPath::Direct,
+        GridRenderer::UploadPath::PixelBuffers,
+        GridRenderer::UploadPath::Persistent
+    };
+
+    GridRenderer::UploadPath current = GridRenderer::GetUploadPath();
+
+    if (ImGui::BeginCombo("Texture upload", GridRenderer::UploadPathName(current)))
+    {
+        for (GridRenderer::UploadPath path : paths)
+        {
+            // Paths the context cannot run are not offered
+            if (!GridRenderer::IsSupported(path)) continue;
+
+            bool isSelected = (current == path);
+
+            if (ImGui::Selectable(GridRenderer::UploadPathName(path), isSelected))
+            {
+                GridRenderer::SetUploadPath(path);
+            }
+            if (isSelected)
+            {
+                ImGui::SetItemDefaultFocus();
+            }
+        }
+        ImGui::EndCombo();
     }
 }
 
@@ -178,6 +474,18 @@ void IMGui::RenderPerformanceWindow(std::vector<double>& GpuData, std::vector<do
     ImGuiIO& io = ImGui::GetIO();
 
     ImGui::Text("Framerate: %.1f FPS", io.Framerate);
+    ImGui::Text("Simulation: %.0f ticks/s, showing tick %llu", SimulationThread::MeasuredTickRate(),
+        static_cast<unsigned long long>(SimulationThread::LatestTick()));
+    ImGui::Text("Catch-up: %llu ticks merged, %llu dropped", static_cast<unsigned long long>(SimulationThread::MergedTicks()),
+        static_cast<unsigned long long>(SimulationThread::DroppedTicks()));
+    ImGui::Text("Sand kernel: %s", SandKernel::LevelName(SandKernel::GetLevel()));
+    ImGui::Text("Grid upload: %.1f KB in %d calls", GridRenderer::LastUploadBytes() / 1024.0, GridRenderer::LastUploadCalls());
+    ImGui::Text("View: %.1fx zoom, detail level %d", Camera::GetZoom(), GridRenderer::ActiveLevel());
+    if (FrameCapture::IsCapturing())
+    {
+        ImGui::Text("Capture queue: %d/%d, %d written, %d dropped", FrameCapture::QueueDepth(), FrameCapture::QueueCapacity,
+            FrameCapture::WrittenFrames(), FrameCapture::DroppedFrames());
+    }
 
     ImGui::Text("WARNING: DATA COLLECTION WILL IMPACT PERFORMANCE");
     if (ImGui::Button(IMGui::isGatheringData == true ? "Stop Gathering Data" : "Start Gathering Data"))
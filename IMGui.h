@@ -1,4 +1,6 @@
 #pragma once
+#include "FrameCapture.h"
+#include "sim/Grid.h"
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
@@ -9,12 +11,23 @@
 #include <queue>
 #include <nvml.h>
 #include <chrono>
+#include <thread>
+#include <algorithm>
 
 
 class IMGui
 {
 private:
 	static inline bool isGatheringData = false;
+	static inline ResizeMode resizeMode = ResizeMode::CropOrPad;
+	// Material poured by the left mouse button
+	static inline ElementType brushMaterial = ElementType::Sand;
+
+	// Largest width or height accepted for a custom grid size
+	static constexpr int MAX_GRID_SIZE = 16384;
+
+	static inline FrameCapture::Format captureFormat = FrameCapture::Format::PngSequence;
+	static inline char capturePath[256] = "capture/frame";
 
 
 public:
@@ -27,6 +40,16 @@ public:
 	// Functions used to create widgets and render Controls
 	static void RenderControlsWindow(int& GRID_WIDTH, int& GRID_HEIGHT);
 	static void SetWindowSizeComboBox(int& GRID_WIDTH, int& GRID_HEIGHT);
+	static ResizeMode GetResizeMode() { return resizeMode; }
+	static void SetBrushComboBox();
+	static ElementType GetBrushMaterial() { return brushMaterial; }
+	static void SetThreadCountSlider();
+	static void SetTickRateSlider();
+	static void SetTurboControls();
+	static void SetEngineComboBox();
+	static void SetUploadPathComboBox();
+	static void SetDrawModeComboBox();
+	static void SetCaptureControls();
 	// Functions used to gather data, create widgets and render data 
 	static void RenderPerformanceWindow(std::vector<double>& GpuData, std::vector<double>& TimeData);
 	static bool GatherData();
@@ -0,0 +1,463 @@
+#include "ShaderManager.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+
+bool ShaderManager::ParseShaderSource(const std::string& text, ShaderSources& out)
+{
+    enum class Section { None, Vertex, Fragment };
+    Section section = Section::None;
+
+    out = ShaderSources();
+    bool hasVertex = false;
+    bool hasFragment = false;
+
+    std::istringstream stream(text);
+    std::string line;
+    while (std::getline(stream, line)) {
+        if (line.find("#shader") != std::string::npos) {
+            if (line.find("vertex") != std::string::npos) {
+                section = Section::Vertex;
+                hasVertex = true;
+            }
+            else if (line.find("fragment") != std::string::npos) {
+                section = Section::Fragment;
+                hasFragment = true;
+            }
+            continue;
+        }
+
+        // Lines before the first section, like the banner comments, belong to no stage
+        if (section == Section::Vertex) {
+            out.vertex += line + '\n';
+        }
+        else if (section == Section::Fragment) {
+            out.fragment += line + '\n';
+        }
+    }
+
+    return hasVertex && hasFragment;
+}
+
+bool ShaderManager::ParseShaderFile(const std::string& path, ShaderSources& out)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "ERROR::SHADER::FILE_NOT_FOUND " << path << std::endl;
+        return false;
+    }
+
+    std::stringstream text;
+    text << file.rdbuf();
+
+    if (!ParseShaderSource(text.str(), out)) {
+        std::cerr << "ERROR::SHADER::MISSING_SECTION " << path << " needs #shader vertex and #shader fragment" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+GLuint ShaderManager::StartShader(GLenum type, const std::string& source)
+{
+    GLuint shader = glCreateShader(type);
+    const char* text = source.c_str();
+    glShaderSource(shader, 1, &text, nullptr);
+    glCompileShader(shader);
+    return shader;
+}
+
+bool ShaderManager::CheckShader(GLuint shader, const std::string& name)
+{
+    GLint success;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        GLchar infoLog[512];
+        glGetShaderInfoLog(shader, 512, nullptr, infoLog);
+        std::cerr << "ERROR::SHADER::COMPILATION_FAILED " << name << "\n" << infoLog << std::endl;
+    }
+    return success;
+}
+
+PendingProgram ShaderManager::StartProgram(const ShaderSources& sources)
+{
+    PendingProgram pending;
+    pending.vertexShader = StartShader(GL_VERTEX_SHADER, sources.vertex);
+    pending.fragmentShader = StartShader(GL_FRAGMENT_SHADER, sources.fragment);
+    pending.program = glCreateProgram();
+
+    StartLink(pending);
+    return pending;
+}
+
+void ShaderManager::StartLink(PendingProgram& pending)
+{
+    glAttachShader(pending.program, pending.vertexShader);
+    glAttachShader(pending.program, pending.fragmentShader);
+
+    // Ask the driver to keep the linked binary around for the cache
+    if (BinaryCacheSupported()) {
+        glProgramParameteri(pending.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // Linking a program whose shaders failed just fails too, FinishProgram reports the shader logs
+    glLinkProgram(pending.program);
+}
+
+bool ShaderManager::IsProgramReady(const PendingProgram& pending)
+{
+    if (!parallelCompile) return true;
+
+    GLint done = GL_FALSE;
+    glGetProgramiv(pending.program, GL_COMPLETION_STATUS_ARB, &done);
+    return done == GL_TRUE;
+}
+
+GLuint ShaderManager::FinishProgram(PendingProgram& pending, const std::string& name)
+{
+    GLuint program = pending.program;
+
+    bool compiled = CheckShader(pending.vertexShader, name);
+    compiled = CheckShader(pending.fragmentShader, name) && compiled;
+
+    glDeleteShader(pending.vertexShader);
+    glDeleteShader(pending.fragmentShader);
+    pending = PendingProgram();
+
+    GLint success = GL_FALSE;
+    if (compiled) {
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success) {
+            GLchar infoLog[512];
+            glGetProgramInfoLog(program, 512, nullptr, infoLog);
+            std::cerr << "ERROR::SHADER::PROGRAM::LINKING_FAILED " << name << "\n" << infoLog << std::endl;
+        }
+    }
+
+    if (!success) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+GLuint ShaderManager::CompileProgram(const ShaderSources& sources, const std::string& name)
+{
+    PendingProgram pending = StartProgram(sources);
+    return FinishProgram(pending, name);
+}
+
+GLuint ShaderManager::LoadProgram(const std::string& path)
+{
+    ShaderSources sources;
+    if (!ParseShaderFile(path, sources)) return 0;
+
+    std::string cachePath;
+    if (BinaryCacheSupported()) {
+        cachePath = CachePath(std::filesystem::path(path).stem().string(), sources);
+
+        GLuint program = LoadBinary(cachePath);
+        if (program != 0) return program;
+    }
+
+    GLuint program = CompileProgram(sources, path);
+    if (program != 0 && !cachePath.empty()) {
+        SaveBinary(program, cachePath);
+    }
+    return program;
+}
+
+uint64_t ShaderManager::Hash(const std::string& text, uint64_t hash)
+{
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+std::string ShaderManager::CachePath(const std::string& name, const ShaderSources& sources)
+{
+    // A binary is only valid for the exact driver that produced it
+    auto glString = [](GLenum id) {
+        const GLubyte* value = glGetString(id);
+        return value ? std::string(reinterpret_cast<const char*>(value)) : std::string();
+    };
+
+    uint64_t hash = Hash(glString(GL_VENDOR));
+    hash = Hash(glString(GL_RENDERER), hash);
+    hash = Hash(glString(GL_VERSION), hash);
+    hash = Hash(sources.vertex, hash);
+    // Keep the stage boundary in the hash, moving a line between stages changes the program
+    hash = Hash("#shader fragment", hash);
+    hash = Hash(sources.fragment, hash);
+
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+    return cacheDirectory + "/" + name + "-" + hex + ".bin";
+}
+
+bool ShaderManager::BinaryCacheSupported()
+{
+    if (!(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)) return false;
+
+    // Some drivers expose the entry points but no format to save in
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+GLuint ShaderManager::LoadBinary(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return 0;
+
+    // File layout: the binary format enum followed by the binary itself
+    GLenum format = 0;
+    file.read(reinterpret_cast<char*>(&format), sizeof(format));
+    if (!file) return 0;
+
+    std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (binary.empty()) return 0;
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, format, binary.data(), static_cast<GLsizei>(binary.size()));
+
+    // Drivers may reject binaries from an older build of themselves, that just means compiling again
+    GLint success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+void ShaderManager::SaveBinary(GLuint program, const std::string& path)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, nullptr, &format, binary.data());
+
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cerr << "Could not write shader cache " << path << std::endl;
+        return;
+    }
+    file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+    file.write(binary.data(), binary.size());
+}
+
+ShaderManager::ProgramHandle ShaderManager::Watch(const std::string& path, GLuint program)
+{
+    if (watched.empty())
+    {
+        // Let the driver compile on its own threads, rebuilds are then polled instead of waited on
+        parallelCompile = GLEW_ARB_parallel_shader_compile || GLEW_KHR_parallel_shader_compile;
+        // Each extension has its own entry point, the other one's may be null
+        if (GLEW_ARB_parallel_shader_compile) {
+            glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+        }
+        else if (GLEW_KHR_parallel_shader_compile) {
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        }
+
+#ifdef __linux__
+        watchDescriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    }
+
+    WatchedProgram entry;
+    entry.path = path;
+    entry.program = program;
+
+    std::error_code error;
+    entry.writeTime = std::filesystem::last_write_time(path, error);
+
+#ifdef __linux__
+    if (watchDescriptor >= 0) {
+        // Watch the directory, editors often save by writing a new file and renaming it over the old one
+        std::string directory = std::filesystem::path(path).parent_path().string();
+        inotify_add_watch(watchDescriptor, directory.empty() ? "." : directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    }
+#endif
+
+    watched.push_back(entry);
+    return static_cast<ProgramHandle>(watched.size() - 1);
+}
+
+std::vector<int> ShaderManager::ChangedFiles()
+{
+    std::vector<int> changed;
+
+#ifdef __linux__
+    if (watchDescriptor >= 0)
+    {
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length;
+        while ((length = read(watchDescriptor, buffer, sizeof(buffer))) > 0) {
+            for (char* at = buffer; at < buffer + length; at += sizeof(inotify_event) + reinterpret_cast<inotify_event*>(at)->len) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(at);
+                if (event->len == 0) continue;
+
+                // Events only carry the file name, every watched file with that name is rebuilt
+                for (int i = 0; i < static_cast<int>(watched.size()); ++i) {
+                    if (std::filesystem::path(watched[i].path).filename() == event->name &&
+                        std::find(changed.begin(), changed.end(), i) == changed.end()) {
+                        changed.push_back(i);
+                    }
+                }
+            }
+        }
+        return changed;
+    }
+#endif
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastPoll < PollInterval) return changed;
+    lastPoll = now;
+
+    for (int i = 0; i < static_cast<int>(watched.size()); ++i) {
+        std::error_code error;
+        auto writeTime = std::filesystem::last_write_time(watched[i].path, error);
+        if (!error && writeTime != watched[i].writeTime) {
+            watched[i].writeTime = writeTime;
+            changed.push_back(i);
+        }
+    }
+    return changed;
+}
+
+void ShaderManager::StartReload(WatchedProgram& entry)
+{
+    ShaderSources sources;
+    if (!ParseShaderFile(entry.path, sources)) return;
+
+    entry.pendingCachePath = BinaryCacheSupported() ? CachePath(std::filesystem::path(entry.path).stem().string(), sources) : std::string();
+
+    if (parallelCompile) {
+        // The driver compiles and links on its own threads, IsProgramReady says when it is done
+        entry.pending = StartProgram(sources);
+        entry.step = ReloadStep::Check;
+        return;
+    }
+
+    // Otherwise the work is spread over the next frames, one blocking step each
+    entry.pending.program = glCreateProgram();
+    entry.pendingSources = std::move(sources);
+    entry.step = ReloadStep::CompileVertex;
+}
+
+void ShaderManager::StepReload(WatchedProgram& entry)
+{
+    PendingProgram& pending = entry.pending;
+
+    // Querying the status makes the driver do the work now, not at some later call in another frame
+    GLint status = GL_FALSE;
+    switch (entry.step)
+    {
+    case ReloadStep::CompileVertex:
+        pending.vertexShader = StartShader(GL_VERTEX_SHADER, entry.pendingSources.vertex);
+        glGetShaderiv(pending.vertexShader, GL_COMPILE_STATUS, &status);
+        entry.step = ReloadStep::CompileFragment;
+        break;
+    case ReloadStep::CompileFragment:
+        pending.fragmentShader = StartShader(GL_FRAGMENT_SHADER, entry.pendingSources.fragment);
+        glGetShaderiv(pending.fragmentShader, GL_COMPILE_STATUS, &status);
+        entry.step = ReloadStep::Link;
+        break;
+    case ReloadStep::Link:
+        StartLink(pending);
+        glGetProgramiv(pending.program, GL_LINK_STATUS, &status);
+        entry.pendingSources = ShaderSources();
+        entry.step = ReloadStep::Check;
+        break;
+    default:
+        break;
+    }
+}
+
+bool ShaderManager::PollReloads()
+{
+    for (int index : ChangedFiles()) {
+        WatchedProgram& entry = watched[index];
+        if (entry.pending.program != 0) {
+            entry.changedAgain = true;
+        }
+        else {
+            StartReload(entry);
+        }
+    }
+
+    bool swapped = false;
+    for (WatchedProgram& entry : watched) {
+        if (entry.pending.program == 0) continue;
+        if (entry.step != ReloadStep::Check) {
+            StepReload(entry);
+            continue;
+        }
+        if (!IsProgramReady(entry.pending)) continue;
+
+        GLuint program = FinishProgram(entry.pending, entry.path);
+        if (program != 0)
+        {
+            glDeleteProgram(entry.program);
+            entry.program = program;
+            swapped = true;
+            std::cout << "Reloaded " << entry.path << std::endl;
+
+            if (!entry.pendingCachePath.empty()) {
+                SaveBinary(program, entry.pendingCachePath);
+            }
+        }
+        else
+        {
+            std::cerr << "Keeping the previous program for " << entry.path << std::endl;
+        }
+
+        // Build the newest version too if the file moved on while this one compiled
+        if (entry.changedAgain) {
+            entry.changedAgain = false;
+            StartReload(entry);
+        }
+    }
+
+    return swapped;
+}
+
+void ShaderManager::Cleanup()
+{
+    for (WatchedProgram& entry : watched) {
+        if (entry.pending.program != 0) {
+            glDeleteShader(entry.pending.vertexShader);
+            glDeleteShader(entry.pending.fragmentShader);
+            glDeleteProgram(entry.pending.program);
+        }
+        glDeleteProgram(entry.program);
+    }
+    watched.clear();
+
+#ifdef __linux__
+    if (watchDescriptor >= 0) {
+        close(watchDescriptor);
+        watchDescriptor = -1;
+    }
+#endif
+}
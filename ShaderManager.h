@@ -0,0 +1,114 @@
+#pragma once
+#include <GL/glew.h>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+
+// Vertex and fragment stages of one sectioned .shader file
+struct ShaderSources {
+	std::string vertex;
+	std::string fragment;
+};
+
+// A program whose compile and link were issued but not yet checked
+struct PendingProgram {
+	GLuint program = 0;
+	GLuint vertexShader = 0;
+	GLuint fragmentShader = 0;
+};
+
+// Loads shader/*.shader files and turns them into linked programs.
+// Linked programs are cached on disk with glGetProgramBinary, keyed by the driver and a hash of
+// the sources, so a later start with the same driver and sources skips GLSL compilation.
+// Watched files are rebuilt when they change and swapped in by PollReloads.
+class ShaderManager
+{
+public:
+	// Index of a watched program, see Watch
+	using ProgramHandle = int;
+
+	// How often file times are compared where inotify is not available
+	static constexpr std::chrono::milliseconds PollInterval{ 250 };
+
+private:
+	static inline std::string cacheDirectory = "shader/cache";
+
+	// Next step of a rebuild. Without parallel compile each step blocks, so PollReloads runs one per frame.
+	enum class ReloadStep { CompileVertex, CompileFragment, Link, Check };
+
+	struct WatchedProgram {
+		std::string path;
+		// The program in use, replaced only by a successful rebuild
+		GLuint program = 0;
+		// Rebuild in flight, its program is 0 when there is none
+		PendingProgram pending;
+		// Cache file for the sources of the rebuild in flight
+		std::string pendingCachePath;
+		ReloadStep step = ReloadStep::Check;
+		// Sources of the rebuild in flight, until it has linked
+		ShaderSources pendingSources;
+		// Last write time seen, only used when polling
+		std::filesystem::file_time_type writeTime;
+		// The file changed while a rebuild was already in flight
+		bool changedAgain = false;
+	};
+
+	static inline std::vector<WatchedProgram> watched;
+	static inline bool parallelCompile = false;
+
+	// inotify descriptor watching the shader directories, -1 when polling file times instead
+	static inline int watchDescriptor = -1;
+	static inline std::chrono::steady_clock::time_point lastPoll;
+
+	// FNV-1a, continued from hash
+	static uint64_t Hash(const std::string& text, uint64_t hash = 14695981039346656037ull);
+	// Cache file for sources on the current driver
+	static std::string CachePath(const std::string& name, const ShaderSources& sources);
+	static bool BinaryCacheSupported();
+	static GLuint LoadBinary(const std::string& path);
+	static void SaveBinary(GLuint program, const std::string& path);
+	static GLuint StartShader(GLenum type, const std::string& source);
+	// Attach the pending shaders and issue the link
+	static void StartLink(PendingProgram& pending);
+	// Log the info log of a shader that failed to compile
+	static bool CheckShader(GLuint shader, const std::string& name);
+	// Watched files that changed since the last call
+	static std::vector<int> ChangedFiles();
+	static void StartReload(WatchedProgram& entry);
+	// Run the next compile or link step of a rebuild and wait for it
+	static void StepReload(WatchedProgram& entry);
+
+public:
+	// Split text on its "#shader vertex" and "#shader fragment" lines. Returns false if a stage is missing.
+	static bool ParseShaderSource(const std::string& text, ShaderSources& out);
+	// Read and parse a .shader file. Returns false and logs if it cannot be read or parsed.
+	static bool ParseShaderFile(const std::string& path, ShaderSources& out);
+
+	// Compile and link sources, name is only used in log messages. Returns 0 on failure.
+	static GLuint CompileProgram(const ShaderSources& sources, const std::string& name);
+	// Issue the compile and link without waiting for either
+	static PendingProgram StartProgram(const ShaderSources& sources);
+	// Whether FinishProgram would return without blocking. Always true without parallel shader compile.
+	static bool IsProgramReady(const PendingProgram& pending);
+	// Check the compile and link, returning the program or 0 after logging why it failed
+	static GLuint FinishProgram(PendingProgram& pending, const std::string& name);
+	// Parse path and return its program, from the binary cache when possible. Returns 0 on failure.
+	static GLuint LoadProgram(const std::string& path);
+
+	// Where cached binaries are written, created on first use
+	static void SetCacheDirectory(const std::string& directory) { cacheDirectory = directory; }
+
+	// Rebuild program from path whenever the file changes
+	static ProgramHandle Watch(const std::string& path, GLuint program);
+	static GLuint Program(ProgramHandle handle) { return watched[handle].program; }
+	// Call once per frame, between frames. Starts rebuilds for changed files and swaps in finished
+	// ones, a rebuild that fails keeps the old program. Returns true if any Program(handle) changed.
+	// Without parallel shader compile a rebuild takes four frames, each still waits for one shader
+	// compile or the link.
+	static bool PollReloads();
+	// Stop watching and delete every watched program
+	static void Cleanup();
+};
@@ -1,4 +1,13 @@
 #include "main.h"
+#include "sim/Grid.h"
+#include "Camera.h"
+#include "FrameCapture.h"
+#include "GridRenderer.h"
+#include "Headless.h"
+#include "ShaderManager.h"
+#include "sim/Simulation.h"
+#include "sim/SimulationThread.h"
+#include "sim/TaskScheduler.h"
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
@@ -14,6 +23,11 @@
 #include <iomanip>
 #include <string>
 #include <map>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
 
 
 
@@ -23,67 +37,77 @@ int WINDOW_HEIGHT = 600;
 int GRID_WIDTH = 300;
 int GRID_HEIGHT = 200;
 bool isDragging = false;
+// Middle mouse drags the view, from the cursor position of the last motion event
+bool isPanning = false;
+double panLastX = 0.0;
+double panLastY = 0.0;
 double frameNumber = 0.0f;
 
-// Element types
-enum class ElementType { Air, Sand };
-
-// Element structure
-struct Element {
-    ElementType type;
-    glm::vec3 color;    
-};
-
 // Initialize the grid with air
-std::vector<std::vector<Element>> grid(GRID_HEIGHT, std::vector<Element>(GRID_WIDTH, { ElementType::Air, {0.0f, 0.0f, 0.0f} }));
+Grid grid(GRID_WIDTH, GRID_HEIGHT);
+// Size of the cells drawn last frame, the live grid may already have another one while a resize is in flight
+int shownWidth = GRID_WIDTH;
+int shownHeight = GRID_HEIGHT;
 
 // Store GPU usage data for plotting
 std::vector<double> gpuData;
 std::vector<double> timeData;
 
+// Latest GPU sample, taken on the task scheduler so NVML stays off the frame
+TaskGroup statsTasks;
+std::atomic<double> latestGpuUsage = 0.0;
+
 
 // Function prototypes
-GLuint CompileShader(GLenum type, const char* source);
-GLuint CreateShaderProgram();
-void UpdateSimulation(std::vector<std::vector<Element>>& grid);
-void DrawGrid(const std::vector<std::vector<Element>>& grid, GLuint shaderProgram);
+void DrawGrid(Grid& grid, GLuint vao, int viewportWidth, int viewportHeight);
 void HandleMouseClick(double xpos, double ypos);
 void HandleMouseDrag(double xpos, double ypos);
 void HandleMouseErase(double xpos, double ypos);
 void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
 void MouseMotionCallback(GLFWwindow* window, double xpos, double ypos);
+void ScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 GLFWwindow* InitFullScreenWindow();
 void AdjustViewport(int width, int height);
 void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
-void ConvertNormalizedToGrid(double normalizedX, double normalizedY, int& gridX, int& gridY);
-float GetDeltaTime();
-
-
-// Vertex Shader source code
-const char* vertexShaderSource = R"(
-    #version 330 core
-    layout(location = 0) in vec2 aPos;
-    layout(location = 1) in vec3 aColor;
-    out vec3 ourColor;
-    uniform mat4 transform;
-    void main() {
-        gl_Position = transform * vec4(aPos, 0.0, 1.0);
-        ourColor = aColor;
-    }
-)";
-
-// Fragment Shader source code
-const char* fragmentShaderSource = R"(
-    #version 330 core
-    in vec3 ourColor;
-    out vec4 FragColor;
-    void main() {
-        FragColor = vec4(ourColor, 1.0f);
+void ScreenToGrid(double xpos, double ypos, int& gridX, int& gridY);
+uint8_t RandomShade();
+void CreateFullScreenQuad(GLuint& VAO, GLuint& VBO);
+int RunHeadless(int ticks, const std::string& capturePath, FrameCapture::Format captureFormat);
+
+
+int main(int argc, char** argv) {
+    // Command line: --headless runs without a window, --ticks sets how long, --grid WxH the grid size,
+    // --capture and --capture-raw record every headless frame
+    bool headless = false;
+    int headlessTicks = 1000;
+    std::string capturePath;
+    FrameCapture::Format captureFormat = FrameCapture::Format::PngSequence;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--headless") {
+            headless = true;
+        }
+        else if (arg == "--ticks" && i + 1 < argc) {
+            headlessTicks = std::atoi(argv[++i]);
+        }
+        else if (arg == "--grid" && i + 1 < argc && std::sscanf(argv[++i], "%dx%d", &GRID_WIDTH, &GRID_HEIGHT) == 2 &&
+                 GRID_WIDTH > 0 && GRID_HEIGHT > 0 && GRID_WIDTH <= 16384 && GRID_HEIGHT <= 16384) {
+            grid.Resize(GRID_WIDTH, GRID_HEIGHT, ResizeMode::CropOrPad);
+        }
+        else if ((arg == "--capture" || arg == "--capture-raw") && i + 1 < argc) {
+            capturePath = argv[++i];
+            captureFormat = arg == "--capture" ? FrameCapture::Format::PngSequence : FrameCapture::Format::RawVideo;
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--headless] [--ticks N] [--grid WxH] [--capture PREFIX | --capture-raw FILE|\"|COMMAND\"]" << std::endl;
+            return -1;
+        }
     }
-)";
 
+    if (headless) {
+        return RunHeadless(headlessTicks, capturePath, captureFormat);
+    }
 
-int main() {
     // Initialize GLFW
     if (!glfwInit()) {
         std::cerr << "Failed to initialize GLFW" << std::endl;
@@ -121,8 +145,17 @@ int main() {
     // Set viewport
     glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
 
-    // Compile and link shaders
-    GLuint shaderProgram = CreateShaderProgram();
+    // Compile and link shaders, or read them back from the binary cache on later runs
+    GLuint shaderProgram = ShaderManager::LoadProgram("shader/VertFrag.shader");
+    GLuint instancedShaderProgram = ShaderManager::LoadProgram("shader/Instanced.shader");
+    if (shaderProgram == 0 || instancedShaderProgram == 0) {
+        std::cerr << "Failed to load shaders" << std::endl;
+        glfwTerminate();
+        return -1;
+    }
+
+    // Start the worker threads shared by the simulation and background jobs
+    TaskScheduler::Start(Simulation::GetThreadCount());
 
     // Initialize ImGui    
    
@@ -134,52 +167,37 @@ int main() {
     // Set mouse motion callback
     glfwSetCursorPosCallback(window, MouseMotionCallback);
 
-    
-  
+    // Scroll wheel zooms, replaces the ImGui callback and forwards to it
+    glfwSetScrollCallback(window, ScrollCallback);
 
-    // Vertex data setup
-    float vertices[] = {
-       // Positions           // Colors
-         1.0f,  1.0f,    0.917f, 0.808f, 0.416f,// Top-Right
-         1.0f, -1.0f,    0.451f, 0.329f, 0.196f,// Bottom-Righ
-        -1.0f,  1.0f,    0.933f, 0.847f, 0.533f,// Top-left
-        -1.0f, -1.0f,    0.588f, 0.482f, 0.275f // Top-right        
-    };    
     
+  
 
-    // Declare Vertex Array Object (VAO) and Vertex Buffer Object (VBO)
+    // Full-screen quad the grid is drawn over
     GLuint VAO;
     GLuint VBO;
+    CreateFullScreenQuad(VAO, VBO);
 
-    // Generate and bind the VAO
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
+    // Cell texture, instance buffers and palette uniforms
+    GridRenderer::Init(shaderProgram, instancedShaderProgram, grid.Width(), grid.Height());
 
-    // Generate and bind the VBO
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-    // Copy vertex data to the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-    // Define the vertex attribute for position (location = 0)
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0); // Enable the vertex attribute
-
-    // Define the vertex attribute for color (location = 1)
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(2 * sizeof(float)));
-    glEnableVertexAttribArray(1); // Enable the vertex attribute
-
-    // Unbind the VBO (optional)
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-    // Unbind the VAO (optional)
-    glBindVertexArray(0);
+    // Rebuild the shaders whenever their files are saved
+    ShaderManager::ProgramHandle gridShader = ShaderManager::Watch("shader/VertFrag.shader", shaderProgram);
+    ShaderManager::ProgramHandle instancedShader = ShaderManager::Watch("shader/Instanced.shader", instancedShaderProgram);
 
-    
+    // Tick on a thread of its own from here on, the grid is only touched through posted commands
+    SimulationThread::Start(grid);
+    int requestedWidth = GRID_WIDTH;
+    int requestedHeight = GRID_HEIGHT;
     
     // Main loop
     while (!glfwWindowShouldClose(window)) {
+
+        // Swap in rebuilt shaders here, between frames, so a frame never mixes programs
+        if (ShaderManager::PollReloads())
+        {
+            GridRenderer::SetPrograms(ShaderManager::Program(gridShader), ShaderManager::Program(instancedShader));
+        }
         
         //set background to light blue
         glClearColor(0.5f, 0.7f, 1.0f, 1.0f);
@@ -189,8 +207,10 @@ int main() {
         ImGuiIO& io = ImGui::GetIO();
 
        
-        // Update simulation
-        UpdateSimulation(grid);
+        // Newest finished tick, the simulation thread is already working on the next ones
+        Grid& shown = SimulationThread::Latest();
+        shownWidth = shown.Width();
+        shownHeight = shown.Height();
         
         
         if (IMGui::GatherData() == true)
@@ -202,9 +222,15 @@ int main() {
                 timeData.erase(timeData.begin());
             }
 
+            // Start the next sample once the previous one is in
+            if (!statsTasks.Busy())
+            {
+                statsTasks.Run([]() { latestGpuUsage = IMGui::GetGPUUsage(); });
+            }
+
             // time and gpu data to the vectors
             timeData.push_back(frameNumber);
-            gpuData.push_back(IMGui::GetGPUUsage());
+            gpuData.push_back(latestGpuUsage);
         }
         
 
@@ -214,16 +240,23 @@ int main() {
         glClear(GL_COLOR_BUFFER_BIT);        
 
         /* Draw grid*/
-        glUseProgram(shaderProgram);
-        glBindVertexArray(VAO);
-        DrawGrid(grid, shaderProgram);        
+        DrawGrid(shown, VAO, WINDOW_WIDTH, WINDOW_HEIGHT);
 
-        glBindVertexArray(0);
-        glUseProgram(0);        
+        // Record the grid before the UI is drawn over it
+        FrameCapture::CaptureFrame(WINDOW_WIDTH, WINDOW_HEIGHT);
 
         // Render ImGui
         IMGui::RenderUI(GRID_WIDTH, GRID_HEIGHT, gpuData, timeData);
 
+        // Apply a grid size picked in the UI between two ticks, the renderer follows once the resized cells are published
+        if (GRID_WIDTH != requestedWidth || GRID_HEIGHT != requestedHeight)
+        {
+            requestedWidth = GRID_WIDTH;
+            requestedHeight = GRID_HEIGHT;
+            ResizeMode mode = IMGui::GetResizeMode();
+            SimulationThread::Post([=](Grid& live) { live.Resize(requestedWidth, requestedHeight, mode); });
+        }
+
         // Swap buffers
         glfwSwapBuffers(window);
 
@@ -239,12 +272,20 @@ int main() {
 
 
     // Cleanup
+    SimulationThread::Stop();
+    FrameCapture::Stop();
+    statsTasks.Wait();
+    TaskScheduler::Stop();
+
     IMGui::CleanupImGui();
 
+    GridRenderer::Cleanup();
+
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
 
-    glDeleteProgram(shaderProgram);
+    // Deletes the current version of every watched program
+    ShaderManager::Cleanup();
 
     glfwDestroyWindow(window);
     glfwTerminate();
@@ -252,142 +293,179 @@ int main() {
     return 0;
 }
 
-GLuint CompileShader(GLenum type, const char* source) {
-    GLuint shader = glCreateShader(type);
-    glShaderSource(shader, 1, &source, nullptr);
-    glCompileShader(shader);
-
-    GLint success;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        GLchar infoLog[512];
-        glGetShaderInfoLog(shader, 512, nullptr, infoLog);
-        std::cerr << "ERROR::SHADER::COMPILATION_FAILED\n" << infoLog << std::endl;
-    }
+void CreateFullScreenQuad(GLuint& VAO, GLuint& VBO)
+{
+    // Full-screen quad, the grid is drawn over it in a single call
+    float vertices[] = {
+       // Positions
+         1.0f,  1.0f,  // Top-right
+         1.0f, -1.0f,  // Bottom-right
+        -1.0f,  1.0f,  // Top-left
+        -1.0f, -1.0f   // Bottom-left
+    };
 
-    return shader;
-}
+    // Generate and bind the VAO
+    glGenVertexArrays(1, &VAO);
+    glBindVertexArray(VAO);
 
-GLuint CreateShaderProgram() {
-    GLuint vertexShader = CompileShader(GL_VERTEX_SHADER, vertexShaderSource);
-    GLuint fragmentShader = CompileShader(GL_FRAGMENT_SHADER, fragmentShaderSource);
-
-    GLuint shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-
-    GLint success;
-    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-    if (!success) {
-        GLchar infoLog[512];
-        glGetProgramInfoLog(shaderProgram, 512, nullptr, infoLog);
-        std::cerr << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-    }
+    // Generate and bind the VBO
+    glGenBuffers(1, &VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+
+    // Copy vertex data to the buffer
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    // Define the vertex attribute for position (location = 0)
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0); // Enable the vertex attribute
 
-    return shaderProgram;
+    // Unbind the VBO (optional)
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Unbind the VAO (optional)
+    glBindVertexArray(0);
 }
 
-void UpdateSimulation(std::vector<std::vector<Element>>& grid)
+int RunHeadless(int ticks, const std::string& capturePath, FrameCapture::Format captureFormat)
 {
-    //std::vector<std::vector<bool>> hasMoved(GRID_HEIGHT, std::vector<bool>(GRID_WIDTH, false));
+    if (!Headless::CreateContext()) {
+        return -1;
+    }
 
-    for (int y = GRID_HEIGHT - 2; y >= 0; --y)
-    {
-        for (int x = 0; x < GRID_WIDTH; ++x)
-        {
-           // if (hasMoved[y][x]) continue;
+    // Without an X display GLEW still loads every GL entry point, only the GLX extensions are missing
+    GLenum glewStatus = glewInit();
+    if (glewStatus != GLEW_OK && glewStatus != GLEW_ERROR_NO_GLX_DISPLAY) {
+        std::cerr << "Failed to initialize GLEW" << std::endl;
+        Headless::Destroy();
+        return -1;
+    }
 
-            Element& currentElement = grid[y][x];
+    std::cout << "Headless on " << glGetString(GL_RENDERER) << ", " << grid.Width() << "x" << grid.Height()
+              << " grid, " << ticks << " ticks" << std::endl;
 
-            //If Sand
-            if (currentElement.type == ElementType::Sand) {
-                // Check if the cell below is within bounds and empty
-                if (y + 1 < GRID_HEIGHT && grid[y + 1][x].type == ElementType::Air)
-                {
-                    std::swap(currentElement, grid[y + 1][x]);
-                    //hasMoved[y + 1][x] = true;
-                }
-                // Check if the cell below is sand and try to move diagonally
-                else if (y + 1 < GRID_HEIGHT && grid[y + 1][x].type == ElementType::Sand)
-                {
-                    if (x > 0 && grid[y + 1][x - 1].type == ElementType::Air) {
-                        std::swap(currentElement, grid[y + 1][x - 1]);
-                        //hasMoved[y + 1][x - 1] = true;
-                    }
-                    else if (x < GRID_WIDTH - 1 && grid[y + 1][x + 1].type == ElementType::Air)
-                    {
-                        std::swap(currentElement, grid[y + 1][x + 1]);
-                        //hasMoved[y + 1][x + 1] = true;
-                    }
-                }
-            }
-        }
-    }  
-}
+    GLuint shaderProgram = ShaderManager::LoadProgram("shader/VertFrag.shader");
+    GLuint instancedShaderProgram = ShaderManager::LoadProgram("shader/Instanced.shader");
+    if (shaderProgram == 0 || instancedShaderProgram == 0) {
+        std::cerr << "Failed to load shaders" << std::endl;
+        Headless::Destroy();
+        return -1;
+    }
 
-void DrawGrid(const std::vector<std::vector<Element>>& grid, GLuint shaderProgram)
-{
-    glUseProgram(shaderProgram);
-    GLuint transformLoc = glGetUniformLocation(shaderProgram, "transform");
+    TaskScheduler::Start(Simulation::GetThreadCount());
+
+    GLuint VAO;
+    GLuint VBO;
+    CreateFullScreenQuad(VAO, VBO);
 
-    for (int y = 0; y < GRID_HEIGHT; ++y) {
-        for (int x = 0; x < GRID_WIDTH; ++x) {
-            if (grid[y][x].type == ElementType::Air) continue;
+    GridRenderer::Init(shaderProgram, instancedShaderProgram, grid.Width(), grid.Height());
+
+    // One pixel per cell
+    if (!Headless::CreateFramebuffer(grid.Width(), grid.Height())) {
+        TaskScheduler::Stop();
+        Headless::Destroy();
+        return -1;
+    }
 
-            glm::mat4 transform = glm::mat4(1.0f);
+    // Pour a block of sand over the middle half of the top quarter
+    for (int y = 0; y < grid.Height() / 4; ++y) {
+        for (int x = grid.Width() / 4; x < grid.Width() * 3 / 4; ++x) {
+            grid.Set(x, y, Element::Make(ElementType::Sand, RandomShade()));
+        }
+    }
 
-            // Map grid coordinates to normalized device coordinates
-            transform = glm::translate(transform, glm::vec3((x + 0.5f) / float(GRID_WIDTH) * 2.0f - 1.0f,
-                (GRID_HEIGHT - (y + 0.5f)) / float(GRID_HEIGHT) * 2.0f - 1.0f,
-                0.0f));
-            transform = glm::scale(transform, glm::vec3(1.0f / GRID_WIDTH, 1.0f / GRID_HEIGHT, 1.0f));
+    // Nothing drives the frame rate here, so waiting for the writer costs no frames
+    if (!capturePath.empty() && !FrameCapture::Start(capturePath, captureFormat, true)) {
+        TaskScheduler::Stop();
+        Headless::Destroy();
+        return -1;
+    }
 
-            glUniformMatrix4fv(transformLoc, 1, GL_FALSE, glm::value_ptr(transform));
+    auto start = std::chrono::steady_clock::now();
 
-            GLuint colorLoc = glGetUniformLocation(shaderProgram, "aColor");
-            glUniform3fv(colorLoc, 1, glm::value_ptr(grid[y][x].color));
+    // Same per-frame work as the window loop, minus input and UI
+    for (int tick = 0; tick < ticks; ++tick) {
+        Simulation::Update(grid);
 
-            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4); // Assuming you are using 4 vertices for a grid cell
-        }
+        glClearColor(0.5f, 0.7f, 1.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        DrawGrid(grid, VAO, grid.Width(), grid.Height());
+        FrameCapture::CaptureFrame(grid.Width(), grid.Height());
+    }
+    FrameCapture::Stop();
+    glFinish();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Checksum of the last frame, so runs can be compared without saving images
+    std::vector<uint8_t> pixels;
+    Headless::ReadPixels(pixels);
+    uint64_t checksum = 14695981039346656037ull;
+    for (uint8_t value : pixels) {
+        checksum = (checksum ^ value) * 1099511628211ull;
     }
+
+    std::cout << std::fixed << std::setprecision(3)
+              << "Ran " << ticks << " ticks in " << seconds << " s (" << (ticks > 0 ? seconds * 1000.0 / ticks : 0.0) << " ms per tick), "
+              << grid.ParticleCount() << " particles, frame checksum " << std::hex << checksum << std::dec << std::endl;
+
+    TaskScheduler::Stop();
+
+    GridRenderer::Cleanup();
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &VBO);
+    glDeleteProgram(shaderProgram);
+    glDeleteProgram(instancedShaderProgram);
+
+    Headless::Destroy();
+    return 0;
 }
 
-void HandleMouseClick(double xpos, double ypos)
+void DrawGrid(Grid& grid, GLuint vao, int viewportWidth, int viewportHeight)
 {
-    // Convert screen coordinates to normalized device coordinates
-    double normalizedX = (xpos / WINDOW_WIDTH) * 2.0f - 1.0f; // [-1, 1]
-    double normalizedY = 1.0f - (ypos / WINDOW_HEIGHT) * 2.0f;
-
-    // Map normalized coordinates to grid coordinates
-    int gridX = static_cast<int>((normalizedX + 1.0f) * 0.5f * GRID_WIDTH);
-    int gridY = static_cast<int>((1.0f - normalizedY) * 0.5f * GRID_HEIGHT);
+    // The part of the grid the camera shows, the renderer picks its level of detail from it
+    Camera::View view = Camera::GetView(grid.Width(), grid.Height());
+    GridRenderer::SetView(static_cast<float>(view.x), static_cast<float>(view.y),
+        static_cast<float>(view.width), static_cast<float>(view.height), viewportWidth, viewportHeight);
+
+    // Send the changed cells or the instances, then one draw call whatever the grid size
+    GridRenderer::Upload(grid);
+    GridRenderer::Draw(vao);
+}
 
+void HandleMouseClick(double xpos, double ypos)
+{
+    int gridX, gridY;
+    ScreenToGrid(xpos, ypos, gridX, gridY);
+    ElementType material = IMGui::GetBrushMaterial();
 
-    if (gridX >= 0 && gridX < GRID_WIDTH && gridY >= 0 && gridY < GRID_HEIGHT) {
-        grid[gridY][gridX] = { ElementType::Sand, {1.0f, 0.85f, 0.55f} };       
-    }
+    SimulationThread::Post([=](Grid& live) {
+        if (live.InBounds(gridX, gridY)) {
+            live.Set(gridX, gridY, Element::Make(material, RandomShade()));
+        }
+    });
 }
 
 void HandleMouseDrag(double xpos, double ypos) {
-    int gridX = static_cast<int>((xpos / WINDOW_WIDTH) * GRID_WIDTH);
-    int gridY = static_cast<int>(((WINDOW_HEIGHT - ypos) / WINDOW_HEIGHT) * GRID_HEIGHT);
+    int gridX, gridY;
+    ScreenToGrid(xpos, ypos, gridX, gridY);
+    ElementType material = IMGui::GetBrushMaterial();
 
-    if (gridX >= 0 && gridX < GRID_WIDTH && gridY >= 0 && gridY < GRID_HEIGHT) {
-        grid[gridY][gridX] = { ElementType::Sand, {1.0f, 0.85f, 0.55f} };
-    }
+    SimulationThread::Post([=](Grid& live) {
+        if (live.InBounds(gridX, gridY)) {
+            live.Set(gridX, gridY, Element::Make(material, RandomShade()));
+        }
+    });
 }
 
 void HandleMouseErase(double xpos, double ypos) {
-    int gridX = static_cast<int>((xpos / WINDOW_WIDTH) * GRID_WIDTH);
-    int gridY = static_cast<int>(((WINDOW_HEIGHT - ypos) / WINDOW_HEIGHT) * GRID_HEIGHT);
+    int gridX, gridY;
+    ScreenToGrid(xpos, ypos, gridX, gridY);
 
-    if (gridX >= 0 && gridX < GRID_WIDTH && gridY >= 0 && gridY < GRID_HEIGHT) {
-        grid[gridY][gridX] = { ElementType::Air, {0.0f, 0.0f, 0.0f} };
-    }
+    SimulationThread::Post([=](Grid& live) {
+        if (live.InBounds(gridX, gridY)) {
+            live.Set(gridX, gridY, Element::Make(ElementType::Air));
+        }
+    });
 }
 
 void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
@@ -399,28 +477,38 @@ void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
             isDragging = false;
         }
     }
+    else if (button == GLFW_MOUSE_BUTTON_MIDDLE) {
+        isPanning = action == GLFW_PRESS;
+        glfwGetCursorPos(window, &panLastX, &panLastY);
+    }
 }
 
 void MouseMotionCallback(GLFWwindow* window, double xpos, double ypos) {
-    if (isDragging) {
-        // Convert window coordinates to normalized device coordinates
-        double normalizedX = (xpos / WINDOW_WIDTH) * 2.0f - 1.0f;
-        double normalizedY = 1.0f - (ypos / WINDOW_HEIGHT) * 2.0f;
+    if (isPanning) {
+        Camera::Pan(xpos - panLastX, ypos - panLastY, WINDOW_WIDTH, WINDOW_HEIGHT);
+        panLastX = xpos;
+        panLastY = ypos;
+    }
 
+    if (isDragging) {
+        // Cell under the cursor through the camera
         int gridX, gridY;
-        ConvertNormalizedToGrid(normalizedX, normalizedY, gridX, gridY);
-
-        // Check bounds and add sand to a 3x3 area
-        for (int dy = -1; dy <= 1; ++dy) {
-            for (int dx = -1; dx <= 1; ++dx) {
-                int newGridX = gridX + dx;
-                int newGridY = gridY + dy;
-
-                if (newGridX >= 0 && newGridX < GRID_WIDTH && newGridY >= 0 && newGridY < GRID_HEIGHT) {
-                    grid[newGridY][newGridX] = { ElementType::Sand };
+        ScreenToGrid(xpos, ypos, gridX, gridY);
+        ElementType material = IMGui::GetBrushMaterial();
+
+        // Check bounds and pour the brush material over a 3x3 area, on the simulation thread between two ticks
+        SimulationThread::Post([=](Grid& live) {
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    int newGridX = gridX + dx;
+                    int newGridY = gridY + dy;
+
+                    if (live.InBounds(newGridX, newGridY)) {
+                        live.Set(newGridX, newGridY, Element::Make(material, RandomShade()));
+                    }
                 }
             }
-        }
+        });
     }   
 }
 
@@ -472,17 +560,24 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
     }
 }
 
-void ConvertNormalizedToGrid(double normalizedX, double normalizedY, int& gridX, int& gridY)
+void ScrollCallback(GLFWwindow* window, double xoffset, double yoffset) {
+    ImGui_ImplGlfw_ScrollCallback(window, xoffset, yoffset);
+
+    // Scrolling a window of the UI must not zoom the grid behind it
+    if (ImGui::GetIO().WantCaptureMouse) return;
+
+    double xpos, ypos;
+    glfwGetCursorPos(window, &xpos, &ypos);
+    Camera::ZoomAt(std::pow(Camera::ZoomStep, yoffset), xpos, ypos, WINDOW_WIDTH, WINDOW_HEIGHT);
+}
+
+void ScreenToGrid(double xpos, double ypos, int& gridX, int& gridY)
 {
-    gridX = static_cast<int>((normalizedX + 1.0f) * 0.5f * GRID_WIDTH);
-    gridY = static_cast<int>((1.0f - normalizedY) * 0.5f * GRID_HEIGHT);
+    // Through the cells on screen, the brush lands where the user sees it
+    Camera::ScreenToGrid(xpos, ypos, WINDOW_WIDTH, WINDOW_HEIGHT, shownWidth, shownHeight, gridX, gridY);
 }
 
-float GetDeltaTime()
+uint8_t RandomShade()
 {
-    static float lastTime = 0.0f;
-    float currentTime = static_cast<float>(glfwGetTime());
-    float deltaTime = currentTime - lastTime;
-    lastTime = currentTime;
-    return deltaTime;    
+    return static_cast<uint8_t>(std::rand() % Element::ShadeLevels);
 }
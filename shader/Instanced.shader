@@ -0,0 +1,37 @@
+///////////////////////////////////////////////////////
+/////////////////////VERTEX SHADER/////////////////////
+///////////////////////////////////////////////////////
+#shader vertex
+#version 330 core
+
+layout(location = 0) in vec2 aPos;
+layout(location = 1) in uvec2 aCell;
+layout(location = 2) in uint aBits;
+out vec3 ourColor;
+// Visible cells as x, y, width, height
+uniform vec4 view;
+uniform vec3 palette[16];
+
+void main()
+{
+    // Corner of the cell in grid coordinates, row 0 is the top of the screen
+    vec2 cell = vec2(aCell) + vec2(aPos.x + 1.0, 1.0 - aPos.y) * 0.5 - view.xy;
+    gl_Position = vec4(cell.x / view.z * 2.0 - 1.0, 1.0 - cell.y / view.w * 2.0, 0.0, 1.0);
+    // Low nibble is the element type, high nibble the shade
+    float brightness = 1.0 - 0.02 * float(aBits >> 4u);
+    ourColor = palette[aBits & 15u] * brightness;
+};
+
+///////////////////////////////////////////////////////
+////////////////////FRAGMENT SHADER////////////////////
+///////////////////////////////////////////////////////
+#shader fragment
+#version 330 core
+
+in vec3 ourColor;
+
+out vec4 FragColor;
+
+void main() {
+    FragColor = vec4(ourColor, 1.0);
+};
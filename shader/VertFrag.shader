@@ -5,14 +5,15 @@
 #version 330 core
 
 layout(location = 0) in vec2 aPos;
-layout(location = 1) in vec3 aColor;
-out vec3 ourColor;
-uniform mat4 transform;
+out vec2 cellCoord;
+// Visible cells as x, y, width, height
+uniform vec4 view;
 
 void main()
 {
-    gl_Position = transform * vec4(aPos, 0.0, 1.0);
-    ourColor = aColor;
+    gl_Position = vec4(aPos, 0.0, 1.0);
+    // Row 0 of the grid is the top of the screen
+    cellCoord = view.xy + vec2(aPos.x + 1.0, 1.0 - aPos.y) * 0.5 * view.zw;
 };
 
 ///////////////////////////////////////////////////////
@@ -21,10 +22,21 @@ void main()
 #shader fragment
 #version 330 core
 
-in vec3 ourColor;
+in vec2 cellCoord;
 
 out vec4 FragColor;
 
+uniform usampler2D cells;
+uniform vec3 palette[16];
+// Mip level to draw from, one texel of level n covers 2^n x 2^n cells
+uniform int level;
+
 void main() {
-    FragColor = vec4(ourColor, 1.0f);
-};
\ No newline at end of file
+    ivec2 cell = min(ivec2(cellCoord) >> level, textureSize(cells, level) - 1);
+    uint bits = texelFetch(cells, cell, level).r;
+    // Low nibble is the element type, high nibble the shade
+    uint type = bits & 15u;
+    if (type == 0u) discard;
+    float brightness = 1.0 - 0.02 * float(bits >> 4u);
+    FragColor = vec4(palette[type] * brightness, 1.0);
+};
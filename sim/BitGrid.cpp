@@ -0,0 +1,111 @@
+#include "BitGrid.h"
+#include "BitOps.h"
+#include <algorithm>
+#include <utility>
+
+
+void BitGrid::Load(const Grid& grid)
+{
+    width = grid.Width();
+    height = grid.Height();
+    wordsPerRow = (width + 63) / 64;
+    bits.assign(static_cast<size_t>(wordsPerRow) * height, 0);
+
+    LoadRect(grid, 0, 0, width, height);
+}
+
+void BitGrid::LoadRect(const Grid& grid, int x0, int y0, int x1, int y1)
+{
+    for (int y = y0; y < y1; ++y)
+    {
+        const Element* cells = grid.Row(y);
+        for (int x = x0; x < x1; ++x) {
+            Set(x, y, cells[x].Type() != ElementType::Air);
+        }
+
+        // Keep the padding past the right edge occupied
+        int used = width % 64;
+        if (used != 0) {
+            Row(y)[wordsPerRow - 1] |= ~0ull << used;
+        }
+    }
+}
+
+void BitGrid::Set(int x, int y, bool occupied)
+{
+    uint64_t& word = Row(y)[x >> 6];
+    uint64_t bit = 1ull << (x & 63);
+    word = occupied ? (word | bit) : (word & ~bit);
+}
+
+uint64_t BitGrid::Candidates(const uint64_t* row, const uint64_t* below, int w) const
+{
+    // Neighbors across word boundaries come from the adjacent words, the grid edges read as occupied
+    uint64_t previous = w > 0 ? below[w - 1] : ~0ull;
+    uint64_t next = w + 1 < wordsPerRow ? below[w + 1] : ~0ull;
+
+    uint64_t down = below[w];
+    uint64_t downLeft = (down << 1) | (previous >> 63);
+    uint64_t downRight = (down >> 1) | (next << 63);
+
+    // Padding bits are occupied but are not sand
+    uint64_t sand = row[w];
+    if (w == wordsPerRow - 1 && width % 64 != 0) {
+        sand &= ~(~0ull << (width % 64));
+    }
+
+    return sand & ~(down & downLeft & downRight);
+}
+
+int BitGrid::Step(Grid& grid)
+{
+    int moves = 0;
+
+    for (int y = height - 2; y >= 0; --y)
+    {
+        uint64_t* row = Row(y);
+        uint64_t* below = Row(y + 1);
+        Element* cells = grid.Row(y);
+        Element* belowCells = grid.Row(y + 1);
+
+        // Columns touched in this row pair, reported to the grid once per row
+        int changedMin = width;
+        int changedMax = -1;
+
+        for (int w = 0; w < wordsPerRow; ++w)
+        {
+            // Recompute after every move, a grain that just landed can block the next one
+            uint64_t candidates = Candidates(row, below, w);
+            while (candidates != 0)
+            {
+                int bit = CountTrailingZeros(candidates);
+                int x = (w << 6) + bit;
+
+                auto occupied = [below](int cell) { return (below[cell >> 6] >> (cell & 63)) & 1; };
+
+                // Same order as the cell engine: straight down, then left, then right
+                int targetX = x;
+                if (occupied(x)) {
+                    targetX = (x > 0 && !occupied(x - 1)) ? x - 1 : x + 1;
+                }
+
+                row[w] &= ~(1ull << bit);
+                below[targetX >> 6] |= 1ull << (targetX & 63);
+                std::swap(cells[x], belowCells[targetX]);
+                ++moves;
+
+                changedMin = std::min(changedMin, std::min(x, targetX));
+                changedMax = std::max(changedMax, std::max(x, targetX));
+
+                uint64_t remaining = bit == 63 ? 0 : ~0ull << (bit + 1);
+                candidates = Candidates(row, below, w) & remaining;
+            }
+        }
+
+        if (changedMax >= 0) {
+            grid.MarkChanged(changedMin, y, changedMax + 1, y + 2);
+        }
+    }
+
+    return moves;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "Grid.h"
+#include <cstdint>
+#include <vector>
+
+
+// One bit of occupancy per cell, 64 cells per word, for scenes made only of Air and Sand.
+// Candidate cells are found a whole word at a time with shifts, ANDs and ORs. Every move is
+// applied to the bits and to the Grid together, so the Grid stays the source of truth and the
+// result matches the cell engine move for move.
+class BitGrid
+{
+private:
+	int width = 0;
+	int height = 0;
+	int wordsPerRow = 0;
+	// Bits past the right edge of a row are kept set so they read as occupied
+	std::vector<uint64_t> bits;
+
+	uint64_t* Row(int y) { return bits.data() + static_cast<size_t>(y) * wordsPerRow; }
+	// Bits of the sand in word w of row that has air below, below-left or below-right
+	uint64_t Candidates(const uint64_t* row, const uint64_t* below, int w) const;
+	void Set(int x, int y, bool occupied);
+
+public:
+	int Width() const { return width; }
+	int Height() const { return height; }
+
+	// Rebuild every row from the grid
+	void Load(const Grid& grid);
+	// Refresh the bits of [x0, x1) x [y0, y1) after the grid was edited from outside
+	void LoadRect(const Grid& grid, int x0, int y0, int x1, int y1);
+	// Advance one tick, applying each move to the bits and to the grid. Returns the number of moves.
+	int Step(Grid& grid);
+};
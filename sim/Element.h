@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+
+
+// Element types, stored in the low bits of an Element. Their properties live in the material table, see Material.h
+enum class ElementType : uint8_t { Air, Sand, Stone, Wood, Water, Count };
+
+constexpr int ElementTypeCount = static_cast<int>(ElementType::Count);
+
+// One grid cell packed into a single byte:
+// bits 0-3 hold the ElementType, bits 4-7 a per-cell shade used to vary the palette color
+struct Element {
+	uint8_t bits;
+
+	static constexpr uint8_t TypeMask = 0x0F;
+	static constexpr uint8_t ShadeShift = 4;
+	static constexpr uint8_t ShadeLevels = 16;
+
+	static constexpr Element Make(ElementType type, uint8_t shade = 0)
+	{
+		return { static_cast<uint8_t>(static_cast<uint8_t>(type) | (shade << ShadeShift)) };
+	}
+
+	constexpr ElementType Type() const { return static_cast<ElementType>(bits & TypeMask); }
+	constexpr uint8_t Shade() const { return bits >> ShadeShift; }
+
+	constexpr bool operator==(const Element& other) const { return bits == other.bits; }
+	constexpr bool operator!=(const Element& other) const { return bits != other.bits; }
+};
+
+static_assert(sizeof(Element) == 1, "Element must stay one byte");
+static_assert(ElementTypeCount <= Element::TypeMask + 1, "every ElementType must fit in the type bits");
@@ -0,0 +1,340 @@
+#include "Grid.h"
+#include "Material.h"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+
+namespace
+{
+    bool IsLiquid(Element cell)
+    {
+        return (StateMask(MatterState::Liquid) >> static_cast<int>(cell.Type())) & 1;
+    }
+}
+
+Grid::Grid(int width, int height)
+    : width(width), height(height),
+      cells(static_cast<size_t>(width) * height, Element::Make(ElementType::Air)),
+      chunksX((width + ChunkSize - 1) / ChunkSize),
+      chunksY((height + ChunkSize - 1) / ChunkSize),
+      chunks(static_cast<size_t>(chunksX) * chunksY),
+      activeBits(static_cast<size_t>(chunksX) * height, 0),
+      idleLow(static_cast<size_t>(chunksX) * height, 0),
+      idleHigh(static_cast<size_t>(chunksX) * height, 0)
+{
+    static_assert(ChunkSize == 64, "worklist words assume 64 cell wide chunks");
+    static_assert(IdleTicksLimit >= 1 && IdleTicksLimit <= 3, "idle counts are two bits wide");
+
+    typeCounts[static_cast<int>(ElementType::Air)] = cells.size();
+}
+
+void Grid::Resize(int newWidth, int newHeight, ResizeMode mode)
+{
+    if (newWidth == width && newHeight == height) return;
+
+    Grid resized(newWidth, newHeight);
+
+    if (mode == ResizeMode::Rescale)
+    {
+        for (int y = 0; y < newHeight; ++y) {
+            const Element* source = Row(static_cast<int>(static_cast<int64_t>(y) * height / newHeight));
+            Element* target = resized.Row(y);
+            for (int x = 0; x < newWidth; ++x) {
+                target[x] = source[static_cast<int64_t>(x) * width / newWidth];
+            }
+        }
+    }
+    else
+    {
+        // Offsets of the old grid inside the new one, the bottom rows stay at the bottom
+        int offsetX = (newWidth - width) / 2;
+        int offsetY = newHeight - height;
+
+        int x0 = std::max(0, offsetX);
+        int x1 = std::min(newWidth, width + offsetX);
+        for (int y = std::max(0, offsetY); y < std::min(newHeight, height + offsetY); ++y) {
+            if (x0 < x1) {
+                std::copy(Row(y - offsetY) + (x0 - offsetX), Row(y - offsetY) + (x1 - offsetX), resized.Row(y) + x0);
+            }
+        }
+    }
+
+    resized.CountTypes();
+
+    bool hadBackBuffer = HasBackBuffer();
+
+    // Everything moved, so every cell gets looked at on the next tick and redrawn
+    resized.WakeRect(0, 0, newWidth, newHeight);
+    resized.MarkChanged(0, 0, newWidth, newHeight);
+    *this = std::move(resized);
+
+    if (hadBackBuffer) {
+        EnableBackBuffer(true);
+    }
+}
+
+void Grid::Set(int x, int y, Element element)
+{
+    --typeCounts[static_cast<int>(At(x, y).Type())];
+    ++typeCounts[static_cast<int>(element.Type())];
+    ChunkOf(x, y).liquidCells.fetch_add(IsLiquid(element) - IsLiquid(At(x, y)), std::memory_order_relaxed);
+
+    At(x, y) = element;
+    WakeCell(x, y);
+}
+
+void Grid::EnableBackBuffer(bool enable)
+{
+    if (enable) {
+        backCells = cells;
+    }
+    else {
+        std::vector<Element>().swap(backCells);
+    }
+}
+
+void Grid::Fill(const Element& element)
+{
+    std::fill(cells.begin(), cells.end(), element);
+    CountTypes();
+    WakeRect(0, 0, width, height);
+    MarkChanged(0, 0, width, height);
+}
+
+void Grid::CollectInstances(std::vector<CellInstance>& out, int x0, int y0, int x1, int y1) const
+{
+    out.clear();
+    out.reserve(ParticleCount());
+
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    x1 = std::min(x1, width);
+    y1 = std::min(y1, height);
+
+    // Type bits of eight cells at once, a zero word means eight air cells
+    constexpr uint64_t typeBits = 0x0101010101010101ull * Element::TypeMask;
+
+    for (int y = y0; y < y1; ++y) {
+        const Element* row = Row(y);
+
+        int x = x0;
+        for (; x + 8 <= x1; x += 8) {
+            uint64_t word;
+            std::memcpy(&word, row + x, sizeof(word));
+            if ((word & typeBits) == 0) continue;
+
+            for (int i = x; i < x + 8; ++i) {
+                if (row[i].Type() != ElementType::Air) {
+                    out.push_back({ static_cast<uint16_t>(i), static_cast<uint16_t>(y), row[i].bits, {} });
+                }
+            }
+        }
+        for (; x < x1; ++x) {
+            if (row[x].Type() != ElementType::Air) {
+                out.push_back({ static_cast<uint16_t>(x), static_cast<uint16_t>(y), row[x].bits, {} });
+            }
+        }
+    }
+}
+
+int Grid::AwakeChunkCount() const
+{
+    int count = 0;
+    for (const Chunk& chunk : chunks) {
+        if (!chunk.next.Empty()) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+void Grid::MarkIdle(int x, int y)
+{
+    size_t word = static_cast<size_t>(y) * chunksX + (x >> 6);
+    uint64_t bit = 1ull << (x & 63);
+
+    int count = ((idleLow[word] & bit) ? 1 : 0) + ((idleHigh[word] & bit) ? 2 : 0) + 1;
+
+    if (count >= IdleTicksLimit) {
+        activeBits[word] &= ~bit;
+        count = 0;
+    }
+
+    idleLow[word] = (count & 1) ? (idleLow[word] | bit) : (idleLow[word] & ~bit);
+    idleHigh[word] = (count & 2) ? (idleHigh[word] | bit) : (idleHigh[word] & ~bit);
+}
+
+void Grid::BeginTick()
+{
+    for (Chunk& chunk : chunks) {
+        chunk.current = chunk.next;
+        chunk.next.Reset();
+    }
+}
+
+void Grid::WakeCell(int x, int y)
+{
+    // Sources are (x - 1 .. x + 1, y - 1) and the cell itself, their landing cells reach one column
+    // further out and one row down. Double-buffered updates need those inside the rect as well.
+    int reach = ChunkOf(x, y).nearLiquid ? wakeReach : 0;
+    WakeRect(x - 2 - reach, y - 1, x + 3 + reach, y + 2, x, y);
+}
+
+void Grid::SetWakeReach(int columns)
+{
+    wakeReach = columns;
+    for (int cy = 0; cy < chunksY; ++cy) {
+        for (int cx = 0; cx < chunksX; ++cx) {
+            bool near = false;
+            for (int ny = std::max(cy - 2, 0); columns > 0 && !near && ny <= std::min(cy + 2, chunksY - 1); ++ny) {
+                for (int nx = std::max(cx - 2, 0); !near && nx <= std::min(cx + 2, chunksX - 1); ++nx) {
+                    near = ChunkAt(nx, ny).liquidCells.load(std::memory_order_relaxed) > 0;
+                }
+            }
+            ChunkAt(cx, cy).nearLiquid = near;
+        }
+    }
+}
+
+void Grid::MoveLiquidCount(int x0, int y0, int x1, int y1)
+{
+    // After the swap each cell sits where the other was
+    int moved = IsLiquid(At(x1, y1)) - IsLiquid(At(x0, y0));
+    if (moved == 0) return;
+
+    ChunkOf(x0, y0).liquidCells.fetch_sub(moved, std::memory_order_relaxed);
+    ChunkOf(x1, y1).liquidCells.fetch_add(moved, std::memory_order_relaxed);
+}
+
+void Grid::WakeRect(int x0, int y0, int x1, int y1)
+{
+    WakeRect(x0, y0, x1, y1, -1, -1);
+}
+
+void Grid::WakeRect(int x0, int y0, int x1, int y1, int changedX, int changedY)
+{
+    // Clip to the grid
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    x1 = std::min(x1, width);
+    y1 = std::min(y1, height);
+    if (x0 >= x1 || y0 >= y1) return;
+
+    // Split the rectangle across every chunk it overlaps
+    for (int cy = y0 / ChunkSize; cy <= (y1 - 1) / ChunkSize; ++cy) {
+        int chunkY0 = cy * ChunkSize;
+        int ry0 = std::max(y0, chunkY0);
+        int ry1 = std::min(y1, chunkY0 + ChunkSize);
+
+        for (int cx = x0 / ChunkSize; cx <= (x1 - 1) / ChunkSize; ++cx) {
+            int chunkX0 = cx * ChunkSize;
+            int rx0 = std::max(x0, chunkX0);
+            int rx1 = std::min(x1, chunkX0 + ChunkSize);
+
+            Chunk& chunk = ChunkAt(cx, cy);
+            Lock(chunk);
+            chunk.current.Include(rx0, ry0, rx1, ry1);
+            chunk.next.Include(rx0, ry0, rx1, ry1);
+
+            if (changedX >= rx0 && changedX < rx1 && changedY >= ry0 && changedY < ry1) {
+                chunk.changed.Include(changedX, changedY, changedX + 1, changedY + 1);
+            }
+
+            // Woken cells join the worklist with a fresh idle count
+            int span = rx1 - rx0;
+            uint64_t mask = (span == 64 ? ~0ull : ((1ull << span) - 1)) << (rx0 & 63);
+            for (int y = ry0; y < ry1; ++y) {
+                size_t word = static_cast<size_t>(y) * chunksX + cx;
+                activeBits[word] |= mask;
+                idleLow[word] &= ~mask;
+                idleHigh[word] &= ~mask;
+            }
+
+            Unlock(chunk);
+        }
+    }
+}
+
+void Grid::MarkChanged(int x0, int y0, int x1, int y1)
+{
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    x1 = std::min(x1, width);
+    y1 = std::min(y1, height);
+    if (x0 >= x1 || y0 >= y1) return;
+
+    for (int cy = y0 / ChunkSize; cy <= (y1 - 1) / ChunkSize; ++cy) {
+        int chunkY0 = cy * ChunkSize;
+
+        for (int cx = x0 / ChunkSize; cx <= (x1 - 1) / ChunkSize; ++cx) {
+            int chunkX0 = cx * ChunkSize;
+
+            Chunk& chunk = ChunkAt(cx, cy);
+            Lock(chunk);
+            chunk.changed.Include(std::max(x0, chunkX0), std::max(y0, chunkY0),
+                std::min(x1, chunkX0 + ChunkSize), std::min(y1, chunkY0 + ChunkSize));
+            Unlock(chunk);
+        }
+    }
+}
+
+void Grid::CopyCells(const Grid& source, const DirtyRect& rect)
+{
+    int x0 = std::max(rect.minX, 0);
+    int y0 = std::max(rect.minY, 0);
+    int x1 = std::min(rect.maxX, width);
+    int y1 = std::min(rect.maxY, height);
+    if (x0 >= x1 || y0 >= y1) return;
+
+    for (int y = y0; y < y1; ++y) {
+        std::memcpy(Row(y) + x0, source.Row(y) + x0, static_cast<size_t>(x1 - x0) * sizeof(Element));
+    }
+    MarkChanged(x0, y0, x1, y1);
+    typeCounts = source.typeCounts;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        chunks[i].liquidCells.store(source.chunks[i].liquidCells.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+}
+
+void Grid::TakeChangedRects(std::vector<DirtyRect>& out)
+{
+    for (Chunk& chunk : chunks) {
+        Lock(chunk);
+        if (!chunk.changed.Empty()) {
+            out.push_back(chunk.changed);
+            chunk.changed.Reset();
+        }
+        Unlock(chunk);
+    }
+}
+
+void Grid::CountTypes()
+{
+    typeCounts.fill(0);
+    for (Chunk& chunk : chunks) {
+        chunk.liquidCells.store(0, std::memory_order_relaxed);
+    }
+
+    for (int y = 0; y < height; ++y) {
+        const Element* row = Row(y);
+        for (int x = 0; x < width; ++x) {
+            ++typeCounts[static_cast<int>(row[x].Type())];
+            if (IsLiquid(row[x])) {
+                ChunkOf(x, y).liquidCells.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+void Grid::Lock(Chunk& chunk)
+{
+    while (chunk.lock.test_and_set(std::memory_order_acquire)) {
+        // Two chunk updates can only collide here for the few cycles a wake takes
+    }
+}
+
+void Grid::Unlock(Chunk& chunk)
+{
+    chunk.lock.clear(std::memory_order_release);
+}
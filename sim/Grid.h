@@ -0,0 +1,200 @@
+#pragma once
+#include "Element.h"
+#include <array>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+// Half-open rectangle of cells [minX, maxX) x [minY, maxY), empty when minX >= maxX
+struct DirtyRect {
+	int minX = INT_MAX;
+	int minY = INT_MAX;
+	int maxX = INT_MIN;
+	int maxY = INT_MIN;
+
+	bool Empty() const { return minX >= maxX || minY >= maxY; }
+	bool ContainsRow(int y) const { return y >= minY && y < maxY; }
+	void Reset() { *this = DirtyRect(); }
+
+	// Grow to cover the half-open rectangle [x0, x1) x [y0, y1)
+	void Include(int x0, int y0, int x1, int y1)
+	{
+		if (x0 < minX) minX = x0;
+		if (y0 < minY) minY = y0;
+		if (x1 > maxX) maxX = x1;
+		if (y1 > maxY) maxY = y1;
+	}
+};
+
+// Simulation bookkeeping for one ChunkSize x ChunkSize block of cells.
+// A chunk whose rects are both empty is asleep and costs nothing to update.
+struct Chunk {
+	// Cells that may move during the tick in progress
+	DirtyRect current;
+	// Cells that may move during the following tick
+	DirtyRect next;
+	// Cells written since the renderer last collected them, see TakeChangedRects
+	DirtyRect changed;
+	// Guards the rects while neighboring chunks are updated on other threads
+	std::atomic_flag lock;
+	// Liquid cells in the chunk, so wakes only reach wide where a liquid may see the change
+	std::atomic<int> liquidCells = 0;
+	// Whether a chunk within two chunks held liquid when the wake reach was last set
+	bool nearLiquid = false;
+};
+
+// How existing cells are carried over when the grid changes size
+enum class ResizeMode {
+	// Keep every cell at its scale, anchored to the bottom center: crops when shrinking, pads with air when growing
+	CropOrPad,
+	// Stretch the old content over the new size, nearest neighbor
+	Rescale
+};
+
+// One non-air cell as the instanced renderer reads it, 8 bytes so every attribute stays aligned
+struct CellInstance {
+	uint16_t x;
+	uint16_t y;
+	// Raw Element bits
+	uint8_t cell;
+	uint8_t pad[3];
+};
+
+// Contiguous row-major cell buffer, row y starts at y * Stride()
+class Grid
+{
+public:
+	// One chunk column is exactly one word of the worklist bitsets
+	static constexpr int ChunkSize = 64;
+	// A worklist cell is dropped after this many visits without moving, at most 3
+	static constexpr int IdleTicksLimit = 2;
+
+private:
+	int width;
+	int height;
+	std::vector<Element> cells;
+	// Second buffer for double-buffered updates, empty unless enabled
+	std::vector<Element> backCells;
+
+	int chunksX;
+	int chunksY;
+	std::vector<Chunk> chunks;
+
+	// Number of cells of each ElementType, moves only swap cells so just edits change them
+	std::array<size_t, ElementTypeCount> typeCounts{};
+
+	// Worklist of cells that may move, one bit per cell and chunksX words per row.
+	// Bit x % 64 of word x / 64 belongs to column x, so each word lives inside one chunk and is
+	// guarded by that chunk's lock. The two idle planes hold a 2-bit count of visits without a move.
+	std::vector<uint64_t> activeBits;
+	std::vector<uint64_t> idleLow;
+	std::vector<uint64_t> idleHigh;
+
+	// Extra columns WakeCell wakes to either side when a liquid is in the chunks they cover, for rules
+	// that look further along a row than one cell
+	int wakeReach = 0;
+
+public:
+	// Allocate a width x height grid filled with air
+	Grid(int width, int height);
+
+	// Reallocate to newWidth x newHeight and remap the current cells. Does nothing if the size is unchanged.
+	void Resize(int newWidth, int newHeight, ResizeMode mode);
+
+	int Width() const { return width; }
+	int Height() const { return height; }
+	// Number of cells between the start of two consecutive rows
+	int Stride() const { return width; }
+
+	bool InBounds(int x, int y) const { return x >= 0 && x < width && y >= 0 && y < height; }
+	size_t Index(int x, int y) const { return static_cast<size_t>(y) * Stride() + x; }
+
+	// Unchecked cell access, callers are expected to test InBounds first.
+	// Writing through these does not wake the chunk, use Set or WakeCell for that.
+	Element& At(int x, int y) { return cells[Index(x, y)]; }
+	const Element& At(int x, int y) const { return cells[Index(x, y)]; }
+
+	// Pointer to the first cell of row y
+	Element* Row(int y) { return cells.data() + Index(0, y); }
+	const Element* Row(int y) const { return cells.data() + Index(0, y); }
+
+	Element* Data() { return cells.data(); }
+	const Element* Data() const { return cells.data(); }
+
+	// Allocate the back buffer as a copy of the current cells, or release it
+	void EnableBackBuffer(bool enable);
+	bool HasBackBuffer() const { return !backCells.empty(); }
+	// Row y of the back buffer, only valid while it is enabled
+	Element* BackRow(int y) { return backCells.data() + Index(0, y); }
+	// Make the back buffer current, this swaps the storage and copies nothing
+	void SwapBuffers() { cells.swap(backCells); }
+
+	// Write a single cell and wake the cells that may react to it
+	void Set(int x, int y, Element element);
+	// Overwrite every cell with the given element and wake the whole grid
+	void Fill(const Element& element);
+
+	// Number of cells that are not air
+	size_t ParticleCount() const { return cells.size() - typeCounts[static_cast<int>(ElementType::Air)]; }
+	size_t TypeCount(ElementType type) const { return typeCounts[static_cast<int>(type)]; }
+	// Share of the cells that are not air, between 0 and 1
+	double FillRatio() const { return static_cast<double>(ParticleCount()) / (static_cast<double>(width) * height); }
+	// Replace out with one instance per non-air cell, in row-major order
+	void CollectInstances(std::vector<CellInstance>& out) const { CollectInstances(out, 0, 0, width, height); }
+	// Same, limited to the cells in [x0, x1) x [y0, y1)
+	void CollectInstances(std::vector<CellInstance>& out, int x0, int y0, int x1, int y1) const;
+
+	int ChunksX() const { return chunksX; }
+	int ChunksY() const { return chunksY; }
+	Chunk& ChunkAt(int cx, int cy) { return chunks[static_cast<size_t>(cy) * chunksX + cx]; }
+	const Chunk& ChunkAt(int cx, int cy) const { return chunks[static_cast<size_t>(cy) * chunksX + cx]; }
+	// Number of chunks with work scheduled for the next tick
+	int AwakeChunkCount() const;
+
+	// Worklist word holding column cx * 64 .. cx * 64 + 63 of row y
+	uint64_t* ActiveRow(int y) { return activeBits.data() + static_cast<size_t>(y) * chunksX; }
+	// Count a visit to (x, y) that did not move anything and drop the cell once it hits IdleTicksLimit
+	void MarkIdle(int x, int y);
+
+	// Start a new tick: the cells woken during the last tick become the work for this one
+	void BeginTick();
+	// Cell (x, y) changed: schedule it, the cells above it that may now fall into it,
+	// and every cell those could land on
+	void WakeCell(int x, int y);
+	// Set the reach for this tick and mark the chunks it applies to. Liquid moves less than a chunk per
+	// tick, so any liquid a wake may reach during the tick started within two chunks of the woken cell.
+	void SetWakeReach(int columns);
+	// Cells (x0, y0) and (x1, y1) were just swapped through row pointers. Moves the liquid counts
+	// along when they lie in different chunks, which only happens at chunk borders.
+	void TrackSwap(int x0, int y0, int x1, int y1)
+	{
+		// Coordinates in different chunks differ in a bit at or above the chunk size
+		if (((x0 ^ x1) | (y0 ^ y1)) >= ChunkSize) {
+			MoveLiquidCount(x0, y0, x1, y1);
+		}
+	}
+	// Schedule every cell in [x0, x1) x [y0, y1) for this tick and the next, and put it on the worklist
+	void WakeRect(int x0, int y0, int x1, int y1);
+
+	// Record that the cells in [x0, x1) x [y0, y1) were written, without waking them
+	void MarkChanged(int x0, int y0, int x1, int y1);
+	// Append the changed rect of every chunk to out, at most one per chunk in row-major chunk order, and clear them
+	void TakeChangedRects(std::vector<DirtyRect>& out);
+	// Copy the cells of rect from a grid of the same size and mark them changed, without waking them.
+	// Takes over the type and liquid counts of source, which are exact once every differing cell has been copied.
+	void CopyCells(const Grid& source, const DirtyRect& rect);
+
+private:
+	// WakeRect, also marking (changedX, changedY) as changed while the chunk is locked. changedX < 0 marks nothing.
+	void WakeRect(int x0, int y0, int x1, int y1, int changedX, int changedY);
+	// Recount typeCounts and the chunk liquid counts from the cells
+	void CountTypes();
+	void MoveLiquidCount(int x0, int y0, int x1, int y1);
+	Chunk& ChunkOf(int x, int y) { return ChunkAt(x / ChunkSize, y / ChunkSize); }
+	// Spin until this thread owns the chunk's rects
+	static void Lock(Chunk& chunk);
+	static void Unlock(Chunk& chunk);
+};
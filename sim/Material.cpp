@@ -0,0 +1,12 @@
+#include "Material.h"
+
+
+Color ElementColor(Element element)
+{
+    const Color& base = MaterialOf(element.Type()).color;
+
+    // Each shade step darkens the base color by 2%, so shade 15 is 70% brightness
+    float brightness = 1.0f - 0.02f * element.Shade();
+
+    return { base.r * brightness, base.g * brightness, base.b * brightness };
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include "Element.h"
+#include <cstdint>
+
+
+// Linear RGB color used by the material palette
+struct Color {
+	float r;
+	float g;
+	float b;
+};
+
+// How a material moves: powders fall and pile up, liquids also spread sideways, gases and solids stay put
+enum class MatterState : uint8_t { Gas, Liquid, Powder, Solid };
+
+// Properties of one ElementType. The simulation compiles them into one update rule per type,
+// so the rules never look anything up at runtime.
+struct Material {
+	const char* name;
+	MatterState state;
+	// A falling material sinks into any cell of lower density that is not solid
+	uint8_t density;
+	// Cells a liquid may spread sideways in one tick
+	uint8_t dispersion;
+	Color color;
+	// Chance, between 0 and 1, that the material catches fire when something next to it burns
+	float flammability;
+};
+
+// Indexed by ElementType, one entry per type
+inline constexpr Material materials[ElementTypeCount] =
+{
+	{ "Air",   MatterState::Gas,    0,   0, { 0.0f,   0.0f,   0.0f   }, 0.0f },
+	{ "Sand",  MatterState::Powder, 160, 0, { 0.917f, 0.808f, 0.416f }, 0.0f },
+	{ "Stone", MatterState::Solid,  250, 0, { 0.498f, 0.490f, 0.510f }, 0.0f },
+	{ "Wood",  MatterState::Solid,  70,  0, { 0.451f, 0.290f, 0.145f }, 0.4f },
+	{ "Water", MatterState::Liquid, 100, 8, { 0.220f, 0.450f, 0.850f }, 0.0f },
+};
+
+constexpr const Material& MaterialOf(ElementType type)
+{
+	return materials[static_cast<int>(type)];
+}
+
+// True for the states that fall
+constexpr bool IsFalling(MatterState state)
+{
+	return state == MatterState::Powder || state == MatterState::Liquid;
+}
+
+// Bit t is set if type t is in the given state
+constexpr uint16_t StateMask(MatterState state)
+{
+	uint16_t mask = 0;
+	for (int t = 0; t < ElementTypeCount; ++t) {
+		if (materials[t].state == state) {
+			mask |= 1u << t;
+		}
+	}
+	return mask;
+}
+
+// Largest sideways reach of any liquid
+constexpr int MaxDispersion()
+{
+	int reach = 0;
+	for (const Material& material : materials) {
+		if (material.state == MatterState::Liquid && material.dispersion > reach) {
+			reach = material.dispersion;
+		}
+	}
+	return reach;
+}
+
+// Bit t is set if a cell of the given type may move into a cell of type t, 0 for types that never move
+constexpr uint16_t DisplaceMask(ElementType type)
+{
+	const Material& mover = MaterialOf(type);
+	if (!IsFalling(mover.state)) return 0;
+
+	uint16_t mask = 0;
+	for (int t = 0; t < ElementTypeCount; ++t) {
+		if (materials[t].state != MatterState::Solid && materials[t].density < mover.density) {
+			mask |= 1u << t;
+		}
+	}
+	return mask;
+}
+
+// Bit t is set if some type may move into a cell of type t
+constexpr uint16_t EnterableMask()
+{
+	uint16_t mask = 0;
+	for (int t = 0; t < ElementTypeCount; ++t) {
+		mask |= DisplaceMask(static_cast<ElementType>(t));
+	}
+	return mask;
+}
+
+// Palette color of the element darkened by its shade bits
+Color ElementColor(Element element);
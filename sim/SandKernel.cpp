@@ -0,0 +1,227 @@
+#include "SandKernel.h"
+#include "Material.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SAND_KERNEL_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+// MSVC accepts intrinsics of any level without per-function flags
+#define SAND_KERNEL_TARGET(isa)
+#define SAND_KERNEL_CTZ(mask) _tzcnt_u32(mask)
+#else
+#define SAND_KERNEL_TARGET(isa) __attribute__((target(isa)))
+#define SAND_KERNEL_CTZ(mask) __builtin_ctz(mask)
+#endif
+
+
+namespace
+{
+    constexpr uint8_t AirBits = static_cast<uint8_t>(ElementType::Air);
+    constexpr uint8_t SandBits = static_cast<uint8_t>(ElementType::Sand);
+    constexpr uint8_t WaterBits = static_cast<uint8_t>(ElementType::Water);
+
+    // The vector paths compare against these types directly
+    static_assert(DisplaceMask(ElementType::Sand) == ((1u << AirBits) | (1u << WaterBits)), "sand no longer sinks into just air and water");
+    static_assert(StateMask(MatterState::Liquid) == (1u << WaterBits), "water is no longer the only liquid");
+    static_assert(StateMask(MatterState::Powder) == (1u << SandBits), "sand is no longer the only powder");
+
+    constexpr bool InMask(uint16_t mask, Element cell)
+    {
+        return (mask >> static_cast<int>(cell.Type())) & 1;
+    }
+
+    // Same test as the vector paths, one cell at a time
+    inline bool IsCandidate(const Element* row, const Element* below, int width, int x)
+    {
+        // A liquid can always try to flow sideways
+        if (InMask(StateMask(MatterState::Liquid), row[x])) return true;
+        if (row[x].Type() != ElementType::Sand) return false;
+
+        constexpr uint16_t sinks = DisplaceMask(ElementType::Sand);
+        return InMask(sinks, below[x])
+            || (x > 0 && InMask(sinks, below[x - 1]))
+            || (x < width - 1 && InMask(sinks, below[x + 1]));
+    }
+
+    int ScanScalar(const Element* row, const Element* below, int width, int x, int end)
+    {
+        while (x < end && !IsCandidate(row, below, width, x)) {
+            ++x;
+        }
+        return x;
+    }
+
+#if SAND_KERNEL_X86
+    SAND_KERNEL_TARGET("sse4.1")
+    int ScanSSE41(const Element* row, const Element* below, int width, int x, int end)
+    {
+        const uint8_t* cells = &row->bits;
+        const uint8_t* lower = &below->bits;
+
+        const __m128i typeMask = _mm_set1_epi8(Element::TypeMask);
+        const __m128i sand = _mm_set1_epi8(SandBits);
+        const __m128i air = _mm_set1_epi8(AirBits);
+        const __m128i water = _mm_set1_epi8(WaterBits);
+
+        while (x < end)
+        {
+            // The vector loads read one cell either side, the first and last cells of a row go scalar
+            if (x == 0 || x + 16 >= width || x + 16 > end) {
+                if (IsCandidate(row, below, width, x)) return x;
+                ++x;
+                continue;
+            }
+
+            __m128i current = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(cells + x)), typeMask);
+            __m128i isSand = _mm_cmpeq_epi8(current, sand);
+            __m128i isWater = _mm_cmpeq_epi8(current, water);
+            __m128i either = _mm_or_si128(isSand, isWater);
+
+            // Nothing to do for 16 cells without sand or water, ptest avoids the movemask round trip
+            if (_mm_testz_si128(either, either)) {
+                x += 16;
+                continue;
+            }
+
+            __m128i down = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lower + x)), typeMask);
+            __m128i downLeft = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lower + x - 1)), typeMask);
+            __m128i downRight = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lower + x + 1)), typeMask);
+
+            // Sand sinks into air and water alike
+            __m128i canFall = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(down, air), _mm_cmpeq_epi8(down, water)),
+                _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(downLeft, air), _mm_cmpeq_epi8(downLeft, water)),
+                    _mm_or_si128(_mm_cmpeq_epi8(downRight, air), _mm_cmpeq_epi8(downRight, water))));
+            __m128i candidate = _mm_or_si128(_mm_and_si128(isSand, canFall), isWater);
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(candidate));
+
+            if (mask != 0) return x + static_cast<int>(SAND_KERNEL_CTZ(mask));
+            x += 16;
+        }
+        return end;
+    }
+
+    SAND_KERNEL_TARGET("avx2")
+    int ScanAVX2(const Element* row, const Element* below, int width, int x, int end)
+    {
+        const uint8_t* cells = &row->bits;
+        const uint8_t* lower = &below->bits;
+
+        const __m256i typeMask = _mm256_set1_epi8(Element::TypeMask);
+        const __m256i sand = _mm256_set1_epi8(SandBits);
+        const __m256i air = _mm256_set1_epi8(AirBits);
+        const __m256i water = _mm256_set1_epi8(WaterBits);
+
+        while (x < end)
+        {
+            // The vector loads read one cell either side, the first and last cells of a row go scalar
+            if (x == 0 || x + 32 >= width || x + 32 > end) {
+                if (IsCandidate(row, below, width, x)) return x;
+                ++x;
+                continue;
+            }
+
+            __m256i current = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(cells + x)), typeMask);
+            __m256i isSand = _mm256_cmpeq_epi8(current, sand);
+            __m256i isWater = _mm256_cmpeq_epi8(current, water);
+            __m256i either = _mm256_or_si256(isSand, isWater);
+
+            if (_mm256_testz_si256(either, either)) {
+                x += 32;
+                continue;
+            }
+
+            __m256i down = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(lower + x)), typeMask);
+            __m256i downLeft = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(lower + x - 1)), typeMask);
+            __m256i downRight = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(lower + x + 1)), typeMask);
+
+            __m256i canFall = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(down, air), _mm256_cmpeq_epi8(down, water)),
+                _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(downLeft, air), _mm256_cmpeq_epi8(downLeft, water)),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(downRight, air), _mm256_cmpeq_epi8(downRight, water))));
+            __m256i candidate = _mm256_or_si256(_mm256_and_si256(isSand, canFall), isWater);
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(candidate));
+
+            if (mask != 0) return x + static_cast<int>(SAND_KERNEL_CTZ(mask));
+            x += 32;
+        }
+        return end;
+    }
+#endif
+}
+
+SandKernel::Level SandKernel::Detect()
+{
+#if SAND_KERNEL_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+
+    if (maxLeaf >= 7) {
+        __cpuidex(info, 7, 0);
+        bool avx2 = (info[1] & (1 << 5)) != 0;
+
+        // AVX state must also be enabled by the OS
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        if (avx2 && osxsave && (_xgetbv(0) & 0x6) == 0x6) {
+            return Level::AVX2;
+        }
+    }
+
+    __cpuid(info, 1);
+    if (info[2] & (1 << 19)) {
+        return Level::SSE41;
+    }
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return Level::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return Level::SSE41;
+    }
+#endif
+#endif
+    return Level::Scalar;
+}
+
+void SandKernel::SetLevel(Level requested)
+{
+    Level supported = Detect();
+    level = static_cast<int>(requested) <= static_cast<int>(supported) ? requested : supported;
+    scan = SelectScan(level);
+}
+
+const char* SandKernel::LevelName(Level value)
+{
+    switch (value)
+    {
+    case Level::AVX2:
+        return "AVX2";
+    case Level::SSE41:
+        return "SSE4.1";
+    default:
+        return "Scalar";
+    }
+}
+
+SandKernel::ScanFunction SandKernel::SelectScan(Level value)
+{
+#if SAND_KERNEL_X86
+    switch (value)
+    {
+    case Level::AVX2:
+        return ScanAVX2;
+    case Level::SSE41:
+        return ScanSSE41;
+    default:
+        break;
+    }
+#endif
+    return ScanScalar;
+}
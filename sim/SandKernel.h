@@ -0,0 +1,37 @@
+#pragma once
+#include "Element.h"
+
+
+// Vectorized row scan used by the cell update.
+// Builds fall-down / fall-left / fall-right masks for many cells at once with byte compares
+// and returns the next cell that could move. Water always counts, it may flow sideways. Cells that cannot move are skipped without
+// touching the scalar rules, which stay the single source of truth for the moves themselves.
+class SandKernel
+{
+public:
+	enum class Level { Scalar, SSE41, AVX2 };
+
+private:
+	using ScanFunction = int (*)(const Element* row, const Element* below, int width, int x, int end);
+
+	static ScanFunction SelectScan(Level value);
+
+public:
+	// Best instruction set supported by the CPU we are running on
+	static Level Detect();
+	// Force a lower level, used to compare kernels. Levels the CPU lacks fall back to Detect()
+	static void SetLevel(Level requested);
+	static Level GetLevel() { return level; }
+	static const char* LevelName(Level value);
+
+	// First x in [x, end) holding water, or sand with air or water below it, below-left or below-right,
+	// or end if there is none
+	static int NextCandidate(const Element* row, const Element* below, int width, int x, int end)
+	{
+		return scan(row, below, width, x, end);
+	}
+
+private:
+	static inline Level level = Detect();
+	static inline ScanFunction scan = SelectScan(level);
+};
@@ -0,0 +1,60 @@
+#include "SimClock.h"
+#include <algorithm>
+
+
+SimClock::SimClock(int tickRate)
+    : tickRate(std::max(0, tickRate))
+{
+}
+
+int SimClock::Advance(double seconds)
+{
+    if (tickRate == 0) {
+        accumulator = 0.0;
+        ++ticks;
+        return 1;
+    }
+
+    double step = 1.0 / tickRate;
+    accumulator += std::max(0.0, seconds);
+
+    // Whole ticks due, the remainder carries over to the next call
+    double due = accumulator / step;
+    if (due < 1.0) return 0;
+
+    int count = maxCatchUp;
+    if (due < maxCatchUp + 1.0) {
+        count = static_cast<int>(due);
+        accumulator -= count * step;
+    }
+    else {
+        // Too far behind: drop the excess ticks, but keep the fraction so the phase does not drift
+        uint64_t whole = static_cast<uint64_t>(due);
+        droppedTicks += whole - count;
+        accumulator -= whole * step;
+    }
+
+    ticks += count;
+    return count;
+}
+
+double SimClock::UntilNextTick() const
+{
+    if (tickRate == 0) return 0.0;
+    return std::max(0.0, 1.0 / tickRate - accumulator);
+}
+
+void SimClock::SetTickRate(int ticksPerSecond)
+{
+    ticksPerSecond = std::max(0, ticksPerSecond);
+    if (ticksPerSecond == tickRate) return;
+
+    // Time saved up at the old rate would come out as a burst at the new one
+    tickRate = ticksPerSecond;
+    accumulator = 0.0;
+}
+
+void SimClock::SetMaxCatchUp(int maxTicks)
+{
+    maxCatchUp = std::max(1, maxTicks);
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+
+
+// Fixed-timestep clock: wall time goes into an accumulator and comes out as whole ticks of
+// 1 / tickRate seconds, so the simulation runs at the same speed however fast it is driven.
+// When the simulation falls behind, at most MaxCatchUp ticks are handed out per call and the
+// rest are dropped, otherwise every slow tick would leave more to catch up on than the last.
+class SimClock
+{
+public:
+	static constexpr int DefaultMaxCatchUp = 4;
+
+private:
+	// Ticks per second, 0 hands out one tick per call
+	int tickRate;
+	int maxCatchUp = DefaultMaxCatchUp;
+	double accumulator = 0.0;
+
+	uint64_t ticks = 0;
+	uint64_t droppedTicks = 0;
+
+public:
+	explicit SimClock(int tickRate);
+
+	// Add elapsed seconds of wall time and return the number of ticks now due, at most MaxCatchUp
+	int Advance(double seconds);
+	// Seconds until the next tick is due, 0 if one already is or the rate is unlimited
+	double UntilNextTick() const;
+	// Forget time already accumulated, for example after a pause
+	void Reset() { accumulator = 0.0; }
+
+	void SetTickRate(int ticksPerSecond);
+	int GetTickRate() const { return tickRate; }
+	void SetMaxCatchUp(int maxTicks);
+	int GetMaxCatchUp() const { return maxCatchUp; }
+
+	// Ticks handed out by Advance since construction
+	uint64_t Ticks() const { return ticks; }
+	// Ticks that were due but skipped by the catch-up limit
+	uint64_t DroppedTicks() const { return droppedTicks; }
+};
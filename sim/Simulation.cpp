@@ -0,0 +1,529 @@
+#include "Simulation.h"
+#include "BitOps.h"
+#include "SandKernel.h"
+#include "TaskScheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <utility>
+#include <vector>
+
+
+namespace
+{
+    // Types each type may move into, and types that something may move into, for the double-buffered gather
+    constexpr std::array<uint16_t, ElementTypeCount> displaceMasks = []() {
+        std::array<uint16_t, ElementTypeCount> masks{};
+        for (int t = 0; t < ElementTypeCount; ++t) {
+            masks[t] = DisplaceMask(static_cast<ElementType>(t));
+        }
+        return masks;
+    }();
+    constexpr uint16_t enterableMask = EnterableMask();
+
+    constexpr bool InMask(uint16_t mask, Element cell)
+    {
+        return (mask >> static_cast<int>(cell.Type())) & 1;
+    }
+
+    // Columns a liquid looks along the row for somewhere to drop. It moves at most its dispersion per tick,
+    // so a surface level within one row per FlowSight columns is at rest.
+    constexpr int FlowSight = 40;
+    // Columns either side of a change where a liquid may now decide differently
+    constexpr int LiquidWakeReach = FlowSight + MaxDispersion() + 1;
+
+    // A parallel pass updates chunks two apart. A liquid reads one reach plus the sight to either side and writes
+    // one reach away, and all of that has to stay clear of the cells the next chunk of the pass touches.
+    static_assert(2 * MaxDispersion() + FlowSight + 2 < Grid::ChunkSize, "liquids would reach into chunks updated at the same time");
+    static_assert(MaxDispersion() + LiquidWakeReach + 3 < Grid::ChunkSize, "liquids would wake cells of chunks updated at the same time");
+
+    // Edges of the run of one liquid around the cell that last tried to flow on this thread. The cells
+    // after it on the same row mostly belong to the same run and reuse the edges instead of scanning.
+    // Only valid within one sweep of a row, any move on the row clears it.
+    struct LiquidRun {
+        const Element* row = nullptr;
+        ElementType type = ElementType::Air;
+        // First cell left of the run that is not the liquid, or the last one scanned
+        int left = 0;
+        // First cell right of the run that is not the liquid once rightFound, else the next one to scan
+        int right = 0;
+        bool rightFound = false;
+        // Nearest column within sight beyond each edge the liquid can drop from, -1 if there is none
+        int leftDrop = -1;
+        int rightDrop = -1;
+    };
+
+    thread_local LiquidRun liquidRun;
+
+    // First column from gap on, stepping by dir over cells of the Enters mask, with a cell of the mask
+    // below it. Gives up after reach steps, or at a cell it cannot enter.
+    template <uint16_t Enters>
+    int FindDrop(const Element* row, const Element* below, int width, int gap, int dir, int reach)
+    {
+        for (int g = gap, steps = 0; steps <= reach && g >= 0 && g < width && InMask(Enters, row[g]); g += dir, ++steps) {
+            if (InMask(Enters, below[g])) return g;
+        }
+        return -1;
+    }
+}
+
+template <size_t... Types>
+constexpr std::array<Simulation::CellRule, ElementTypeCount> Simulation::MakeCellRules(std::index_sequence<Types...>)
+{
+    return { &UpdateCell<static_cast<ElementType>(Types)>... };
+}
+
+const std::array<Simulation::CellRule, ElementTypeCount> Simulation::cellRules =
+    Simulation::MakeCellRules(std::make_index_sequence<ElementTypeCount>());
+
+void Simulation::SetThreadCount(int count)
+{
+    threadCount = std::max(1, count);
+    TaskScheduler::Resize(threadCount);
+}
+
+void Simulation::SetEngine(Engine value)
+{
+    engine.store(value, std::memory_order_relaxed);
+}
+
+const char* Simulation::EngineName(Engine value)
+{
+    switch (value)
+    {
+    case Engine::BitPlanes:
+        return "Bit planes";
+    default:
+        return "Cells";
+    }
+}
+
+int Simulation::Update(Grid& grid)
+{
+    ++tickCount;
+
+    // Bit planes treat every full cell as sand, so any other material sends the tick to the cell engine
+    size_t airAndSand = grid.TypeCount(ElementType::Air) + grid.TypeCount(ElementType::Sand);
+    if (GetEngine() == Engine::BitPlanes && airAndSand == static_cast<size_t>(grid.Width()) * grid.Height()) {
+        if (!IsOnBitPlanes()) {
+            // The cell engine may have moved anything since the bit grid was last loaded
+            bitGridSource = nullptr;
+            bitPlanesActive.store(true, std::memory_order_relaxed);
+        }
+        return UpdateBitPlanes(grid);
+    }
+
+    if (IsOnBitPlanes()) {
+        grid.WakeRect(0, 0, grid.Width(), grid.Height());
+        bitPlanesActive.store(false, std::memory_order_relaxed);
+    }
+
+    if (floorRow.size() != static_cast<size_t>(grid.Width())) {
+        floorRow.assign(grid.Width(), Element::Make(ElementType::Stone));
+    }
+
+    // The gather has no sideways moves, liquids update in place. Dropping the back buffer
+    // meanwhile makes it a fresh copy when the gather takes over again.
+    bool hasLiquids = false;
+    for (int t = 0; t < ElementTypeCount; ++t) {
+        hasLiquids |= materials[t].state == MatterState::Liquid && grid.TypeCount(static_cast<ElementType>(t)) > 0;
+    }
+    bool gather = IsDoubleBuffered() && !hasLiquids;
+    grid.SetWakeReach(hasLiquids ? LiquidWakeReach : 0);
+
+    if (grid.HasBackBuffer() != gather) {
+        grid.EnableBackBuffer(gather);
+    }
+
+    if (gather) {
+        return UpdateDoubleBuffered(grid);
+    }
+    // A single thread always takes the serial path so its result matches the original sweep bit for bit.
+    // The checkerboard passes visit chunks in another order, so they land on other cells than the serial
+    // sweep, but on the same cells for any count of two threads or more.
+    if (threadCount <= 1) {
+        return UpdateSerial(grid);
+    }
+    return UpdateParallel(grid);
+}
+
+int Simulation::UpdateSpan(Grid& grid, Element* row, Element* below, int y, int cx, const DirtyRect& dirty, int& nextX)
+{
+    int moves = 0;
+
+    if (IsWorklistEnabled())
+    {
+        // Bits of the word from column first on
+        const int chunkX = cx * Grid::ChunkSize;
+        auto from = [chunkX](int first) {
+            int bit = first - chunkX;
+            return bit <= 0 ? ~0ull : bit >= 64 ? 0 : ~0ull << bit;
+        };
+
+        // Re-read the word after every cell, moves wake cells further along the row
+        uint64_t* active = grid.ActiveRow(y) + cx;
+        uint64_t remaining = from(nextX);
+
+        while (uint64_t pending = *active & remaining)
+        {
+            int x = chunkX + CountTrailingZeros(pending);
+
+            int resume = cellRules[static_cast<int>(row[x].Type())](grid, row, below, x, y);
+            if (resume >= 0) {
+                ++moves;
+            }
+            else {
+                grid.MarkIdle(x, y);
+            }
+
+            nextX = std::max(x, resume) + 1;
+            remaining = from(nextX);
+        }
+        return moves;
+    }
+
+    // Jump straight to the cells that have somewhere to go
+    const int width = grid.Width();
+    const int endX = dirty.maxX;
+    for (int x = SandKernel::NextCandidate(row, below, width, std::max(dirty.minX, nextX), endX); x < endX;
+        x = SandKernel::NextCandidate(row, below, width, nextX, endX))
+    {
+        int resume = cellRules[static_cast<int>(row[x].Type())](grid, row, below, x, y);
+        if (resume >= 0) {
+            ++moves;
+        }
+        nextX = std::max(x, resume) + 1;
+    }
+    return moves;
+}
+
+template <ElementType Type>
+int Simulation::UpdateCell(Grid& grid, Element* row, Element* below, int x, int y)
+{
+    constexpr Material material = MaterialOf(Type);
+
+    if constexpr (material.state == MatterState::Liquid) {
+        return Flow<Type, DisplaceMask(Type), material.dispersion>(grid, row, below, x, y);
+    }
+    else if constexpr (material.state == MatterState::Powder) {
+        return Fall<DisplaceMask(Type)>(grid, row, below, x, y);
+    }
+    else {
+        // Gases and solids stay where they are
+        return -1;
+    }
+}
+
+template <uint16_t Displaces>
+int Simulation::Fall(Grid& grid, Element* row, Element* below, int x, int y)
+{
+    int targetX = -1;
+
+    // Check if the cell below can be displaced
+    if (InMask(Displaces, below[x]))
+    {
+        targetX = x;
+    }
+    // Otherwise try to move diagonally
+    else if (x > 0 && InMask(Displaces, below[x - 1]))
+    {
+        targetX = x - 1;
+    }
+    else if (x < grid.Width() - 1 && InMask(Displaces, below[x + 1]))
+    {
+        targetX = x + 1;
+    }
+
+    if (targetX < 0) return -1;
+
+    std::swap(row[x], below[targetX]);
+    grid.TrackSwap(x, y, targetX, y + 1);
+
+    // Both cells changed, so their neighbors get another look this tick and next
+    grid.WakeCell(x, y);
+    grid.WakeCell(targetX, y + 1);
+    return x;
+}
+
+template <ElementType Type, uint16_t Displaces, int Dispersion>
+int Simulation::Flow(Grid& grid, Element* row, Element* below, int x, int y)
+{
+    LiquidRun& run = liquidRun;
+
+    int fell = Fall<Displaces>(grid, row, below, x, y);
+    if (fell >= 0) {
+        // The cell left a hole in its run
+        run.row = nullptr;
+        return fell;
+    }
+
+    const int width = grid.Width();
+
+    // Scan the run around x unless the last cell to flow already did. The left edge is found once,
+    // cells further right are further from it.
+    if (run.row != row || run.type != Type || x <= run.left || x >= run.right) {
+        int left = x - 1;
+        while (left >= 0 && x - left <= Dispersion && row[left].Type() == Type) {
+            --left;
+        }
+
+        run = { row, Type, left, x + 1, false, -1, -1 };
+        if (left >= 0 && x - left <= Dispersion) {
+            run.leftDrop = FindDrop<Displaces>(row, below, width, left, -1, FlowSight);
+        }
+    }
+
+    // Grow the run to the right just as far as this cell can reach, so a long row of liquid is scanned once
+    while (!run.rightFound && run.right - x <= Dispersion) {
+        if (run.right < width && row[run.right].Type() == Type) {
+            ++run.right;
+            continue;
+        }
+
+        run.rightFound = true;
+        if (run.right < width) {
+            run.rightDrop = FindDrop<Displaces>(row, below, width, run.right, 1, FlowSight);
+        }
+    }
+
+    // Only head for somewhere the liquid will fall next, so a level surface comes to rest
+    bool canLeft = run.leftDrop >= 0 && x - run.left <= Dispersion;
+    bool canRight = run.rightFound && run.rightDrop >= 0 && run.right - x <= Dispersion;
+    if (!canLeft && !canRight) return -1;
+
+    // The nearer drop wins, ties alternate every tick so puddles spread evenly
+    int leftDistance = x - run.leftDrop;
+    int rightDistance = run.rightDrop - x;
+    bool goLeft = canLeft && (!canRight || leftDistance < rightDistance || (leftDistance == rightDistance && (tickCount & 1) == 0));
+
+    // A drop further than one reach is approached over several ticks
+    int targetX = goLeft ? std::max(run.leftDrop, x - Dispersion) : std::min(run.rightDrop, x + Dispersion);
+
+    std::swap(row[x], row[targetX]);
+    grid.TrackSwap(x, y, targetX, y);
+    grid.WakeCell(x, y);
+    grid.WakeCell(targetX, y);
+
+    // The run just changed shape
+    run.row = nullptr;
+
+    // The sweep goes on past a cell that moved right, it must not move again this tick
+    return std::max(x, targetX);
+}
+
+int Simulation::UpdateSerial(Grid& grid)
+{
+    const int height = grid.Height();
+    int moves = 0;
+
+    // Pick up the cells woken during the previous tick and by the brush
+    grid.BeginTick();
+
+    for (int y = height - 1; y >= 0; --y)
+    {
+        Element* row = grid.Row(y);
+        Element* below = BelowRow(grid, y);
+        const int cy = y / Grid::ChunkSize;
+        int nextX = 0;
+        liquidRun.row = nullptr;
+
+        for (int cx = 0; cx < grid.ChunksX(); ++cx)
+        {
+            // Only visit the part of this row that is dirty in the chunk, sleeping chunks are skipped entirely
+            const DirtyRect& dirty = grid.ChunkAt(cx, cy).current;
+            if (!dirty.ContainsRow(y)) continue;
+
+            moves += UpdateSpan(grid, row, below, y, cx, dirty, nextX);
+        }
+    }
+    return moves;
+}
+
+int Simulation::UpdateChunk(Grid& grid, int cx, int cy)
+{
+    const DirtyRect& dirty = grid.ChunkAt(cx, cy).current;
+
+    const int startY = std::min(dirty.maxY, grid.Height()) - 1;
+    int moves = 0;
+
+    for (int y = startY; y >= dirty.minY; --y)
+    {
+        Element* row = grid.Row(y);
+        Element* below = BelowRow(grid, y);
+
+        // Re-read the rect each row, moves lower in the chunk may have widened it.
+        // A liquid flowing into the next chunk column can still move again when that chunk's pass runs.
+        // Other chunks of the last pass may have changed this row since this thread last swept it.
+        int nextX = 0;
+        liquidRun.row = nullptr;
+        moves += UpdateSpan(grid, row, below, y, cx, dirty, nextX);
+    }
+    return moves;
+}
+
+int Simulation::UpdateParallel(Grid& grid)
+{
+    grid.BeginTick();
+
+    std::atomic<int> moves = 0;
+
+    // A chunk only reads and writes cells within one cell of its own border, or a few liquid reaches
+    // sideways, so chunks two apart in both directions never touch the same cells. Passes are {x parity, y parity}.
+    static const int passes[4][2] = { {0, 1}, {1, 1}, {0, 0}, {1, 0} };
+
+    std::vector<std::pair<int, int>> work;
+
+    for (const auto& pass : passes)
+    {
+        // Collect the awake chunks of this color, chunks woken by earlier passes are included
+        work.clear();
+        for (int cy = grid.ChunksY() - 1; cy >= 0; --cy)
+        {
+            if ((cy & 1) != pass[1]) continue;
+
+            for (int cx = pass[0]; cx < grid.ChunksX(); cx += 2)
+            {
+                if (!grid.ChunkAt(cx, cy).current.Empty()) {
+                    work.emplace_back(cx, cy);
+                }
+            }
+        }
+
+        if (work.empty()) continue;
+
+        // Chunks in one pass are independent, idle threads steal whatever chunks are left
+        TaskScheduler::ParallelFor(0, static_cast<int>(work.size()), 1, [&](int first, int last) {
+            int rangeMoves = 0;
+            for (int i = first; i < last; ++i) {
+                rangeMoves += UpdateChunk(grid, work[i].first, work[i].second);
+            }
+            moves.fetch_add(rangeMoves, std::memory_order_relaxed);
+        });
+    }
+    return moves;
+}
+
+int Simulation::FrontTarget(const Grid& grid, int x, int y, bool preferLeft)
+{
+    if (y >= grid.Height() - 1) return -1;
+
+    const uint16_t displaces = displaceMasks[static_cast<int>(grid.At(x, y).Type())];
+    if (displaces == 0) return -1;
+
+    const Element* below = grid.Row(y + 1);
+    if (InMask(displaces, below[x])) return x;
+
+    // The diagonal tried first alternates every tick, so piles do not lean to one side
+    const int first = preferLeft ? x - 1 : x + 1;
+    const int second = preferLeft ? x + 1 : x - 1;
+
+    if (first >= 0 && first < grid.Width() && InMask(displaces, below[first])) return first;
+    if (second >= 0 && second < grid.Width() && InMask(displaces, below[second])) return second;
+    return -1;
+}
+
+int Simulation::FrontSource(const Grid& grid, int x, int y, bool preferLeft)
+{
+    if (y == 0) return -1;
+
+    // Falling straight down beats sliding, then the diagonal preferred this tick beats the other one
+    if (FrontTarget(grid, x, y - 1, preferLeft) == x) return x;
+
+    const int first = preferLeft ? x + 1 : x - 1;
+    const int second = preferLeft ? x - 1 : x + 1;
+
+    if (first >= 0 && first < grid.Width() && FrontTarget(grid, first, y - 1, preferLeft) == x) return first;
+    if (second >= 0 && second < grid.Width() && FrontTarget(grid, second, y - 1, preferLeft) == x) return second;
+    return -1;
+}
+
+int Simulation::GatherRect(Grid& grid, const DirtyRect& rect, bool preferLeft)
+{
+    int moves = 0;
+
+    for (int y = rect.minY; y < rect.maxY; ++y)
+    {
+        const Element* row = grid.Row(y);
+        Element* back = grid.BackRow(y);
+
+        for (int x = rect.minX; x < rect.maxX; ++x)
+        {
+            Element next = row[x];
+
+            if (displaceMasks[static_cast<int>(row[x].Type())] != 0) {
+                // A cell leaves only if it wins its landing cell, and swaps places with what was there
+                int target = FrontTarget(grid, x, y, preferLeft);
+                if (target >= 0 && FrontSource(grid, target, y + 1, preferLeft) == x) {
+                    next = grid.At(target, y + 1);
+                    ++moves;
+                }
+            }
+            else if (InMask(enterableMask, row[x])) {
+                int source = FrontSource(grid, x, y, preferLeft);
+                if (source >= 0) {
+                    next = grid.At(source, y - 1);
+                }
+            }
+
+            back[x] = next;
+            if (next != row[x]) {
+                grid.WakeCell(x, y);
+            }
+        }
+    }
+    return moves;
+}
+
+int Simulation::UpdateDoubleBuffered(Grid& grid)
+{
+    grid.BeginTick();
+
+    std::atomic<int> moves = 0;
+
+    const bool preferLeft = (tickCount & 1) == 0;
+
+    // Copy the rects first, wakes from neighboring chunks grow them while the gather runs.
+    // Cells outside every rect did not change last tick, so both buffers already agree there.
+    std::vector<DirtyRect> work;
+    for (int cy = 0; cy < grid.ChunksY(); ++cy) {
+        for (int cx = 0; cx < grid.ChunksX(); ++cx) {
+            const DirtyRect& dirty = grid.ChunkAt(cx, cy).current;
+            if (!dirty.Empty()) {
+                work.push_back(dirty);
+            }
+        }
+    }
+
+    TaskScheduler::ParallelFor(0, static_cast<int>(work.size()), 1, [&](int first, int last) {
+        int rangeMoves = 0;
+        for (int i = first; i < last; ++i) {
+            rangeMoves += GatherRect(grid, work[i], preferLeft);
+        }
+        moves.fetch_add(rangeMoves, std::memory_order_relaxed);
+    });
+
+    grid.SwapBuffers();
+    return moves;
+}
+
+int Simulation::UpdateBitPlanes(Grid& grid)
+{
+    if (bitGridSource != &grid || bitGrid.Width() != grid.Width() || bitGrid.Height() != grid.Height()) {
+        bitGrid.Load(grid);
+        bitGridSource = &grid;
+    }
+    else {
+        // The only cells woken since the last tick are brush strokes, copy them into the bit grid
+        for (int cy = 0; cy < grid.ChunksY(); ++cy) {
+            for (int cx = 0; cx < grid.ChunksX(); ++cx) {
+                const DirtyRect& woken = grid.ChunkAt(cx, cy).next;
+                if (!woken.Empty()) {
+                    bitGrid.LoadRect(grid, woken.minX, woken.minY, woken.maxX, woken.maxY);
+                }
+            }
+        }
+    }
+
+    // Consume the wakes, bit plane moves do not schedule any
+    grid.BeginTick();
+    return bitGrid.Step(grid);
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include "BitGrid.h"
+#include "Grid.h"
+#include "Material.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+
+class Simulation
+{
+public:
+	// Cells walks the byte grid, BitPlanes finds moving grains 64 cells at a time on a bit grid.
+	// Bit planes only know full and empty cells, so scenes with anything but Air and Sand run on Cells.
+	enum class Engine { Cells, BitPlanes };
+
+private:
+	static inline int threadCount = 1;
+	// Settings are written by the simulation thread and read by the UI every frame
+	static inline std::atomic<Engine> engine = Engine::Cells;
+	static inline std::atomic<bool> doubleBuffered = false;
+	static inline std::atomic<bool> worklist = true;
+	static inline uint64_t tickCount = 0;
+
+	// Occupancy mirror used by the BitPlanes engine, rebuilt whenever it no longer matches the grid
+	static inline BitGrid bitGrid;
+	static inline const Grid* bitGridSource = nullptr;
+	// Set while ticks run on the bit grid, whose moves do not maintain the dirty rects
+	static inline std::atomic<bool> bitPlanesActive = false;
+	// Row of stone under the bottom row, so liquids there can spread without the rules checking for the edge
+	static inline std::vector<Element> floorRow;
+
+	// Update of one cell. Returns the column on row y the sweep goes on after, which is past x
+	// when a liquid flowed right so it is not moved twice in one tick, or -1 if the cell stayed.
+	using CellRule = int (*)(Grid& grid, Element* row, Element* below, int x, int y);
+	// Rule of every ElementType, compiled from the material table. Indexed by type, so adding
+	// a material adds an entry here and never a branch to the rules of the others.
+	static const std::array<CellRule, ElementTypeCount> cellRules;
+
+	template <size_t... Types>
+	static constexpr std::array<CellRule, ElementTypeCount> MakeCellRules(std::index_sequence<Types...>);
+	// Rule for Type, picked at compile time from its state and density
+	template <ElementType Type>
+	static int UpdateCell(Grid& grid, Element* row, Element* below, int x, int y);
+	// Move the cell at (x, y) one row down, straight or diagonally, into a cell whose type is in the Displaces mask
+	template <uint16_t Displaces>
+	static int Fall(Grid& grid, Element* row, Element* below, int x, int y);
+	// Fall, or else move the liquid up to Dispersion cells sideways, through the run of the same liquid
+	// it sits in and the cells it may enter beyond, towards the nearest spot in sight it can drop from
+	template <ElementType Type, uint16_t Displaces, int Dispersion>
+	static int Flow(Grid& grid, Element* row, Element* below, int x, int y);
+
+	// Update every dirty cell of one chunk, bottom row first. Returns the number of moves.
+	static int UpdateChunk(Grid& grid, int cx, int cy);
+	// Visit row y of the dirty part of chunk column cx, through the worklist or the SIMD scan, from column nextX on.
+	// Leaves nextX past the last cell visited or flowed into. Returns the number of moves.
+	static int UpdateSpan(Grid& grid, Element* row, Element* below, int y, int cx, const DirtyRect& dirty, int& nextX);
+	// Row under row y, the floor row below the bottom one
+	static Element* BelowRow(Grid& grid, int y) { return y + 1 < grid.Height() ? grid.Row(y + 1) : floorRow.data(); }
+	// Column on row y + 1 the cell at (x, y) wants to move to, or -1. Reads the front buffer only.
+	static int FrontTarget(const Grid& grid, int x, int y, bool preferLeft);
+	// Column on row y - 1 of the cell that wins cell (x, y) this tick, or -1
+	static int FrontSource(const Grid& grid, int x, int y, bool preferLeft);
+	// Write the next state of every cell in rect to the back buffer. Returns the number of grains that left their cell.
+	static int GatherRect(Grid& grid, const DirtyRect& rect, bool preferLeft);
+
+public:
+	// Number of threads used by Update, 1 runs the serial sweep. Resizes the shared TaskScheduler.
+	static void SetThreadCount(int count);
+	static int GetThreadCount() { return threadCount; }
+
+	// Read from one buffer and write the other, so no grain can move twice in a tick.
+	// The gather only knows falling moves, so scenes with liquids keep updating in place.
+	static void SetDoubleBuffered(bool enable) { doubleBuffered.store(enable, std::memory_order_relaxed); }
+	static bool IsDoubleBuffered() { return doubleBuffered.load(std::memory_order_relaxed); }
+
+	// Visit only worklist cells instead of scanning whole dirty rects
+	static void SetWorklist(bool enable) { worklist.store(enable, std::memory_order_relaxed); }
+	static bool IsWorklistEnabled() { return worklist.load(std::memory_order_relaxed); }
+
+	static void SetEngine(Engine value);
+	static Engine GetEngine() { return engine.load(std::memory_order_relaxed); }
+	// False while BitPlanes is selected but the scene holds other materials than Air and Sand
+	static bool IsOnBitPlanes() { return bitPlanesActive.load(std::memory_order_relaxed); }
+	static const char* EngineName(Engine value);
+
+	// Advance the grid by one tick using the selected engine and thread count.
+	// Returns the number of grains that moved, 0 once the grid has settled.
+	static int Update(Grid& grid);
+	// Single threaded sweep over the whole grid, bottom row first and left to right
+	static int UpdateSerial(Grid& grid);
+	// Checkerboard sweep: four passes over chunks, no two neighboring chunks are updated at the same time
+	static int UpdateParallel(Grid& grid);
+	// Double-buffered sweep, every awake chunk at once since chunks only read the front buffer
+	static int UpdateDoubleBuffered(Grid& grid);
+	// Bit plane sweep, single threaded, same moves as UpdateSerial
+	static int UpdateBitPlanes(Grid& grid);
+};
@@ -0,0 +1,230 @@
+#include "SimulationThread.h"
+#include "Simulation.h"
+#include <algorithm>
+#include <chrono>
+
+
+void SimulationThread::Start(Grid& live)
+{
+    if (IsRunning()) return;
+
+    grid = &live;
+
+    // Hand the render thread real cells before the first tick
+    Publish();
+    snapshots.Update();
+
+    running = true;
+    thread = std::thread(Loop);
+}
+
+void SimulationThread::Stop()
+{
+    if (!IsRunning()) return;
+
+    running = false;
+    thread.join();
+    RunCommands();
+}
+
+void SimulationThread::Post(Command command)
+{
+    if (!IsRunning()) {
+        if (grid) command(*grid);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(commandMutex);
+    commands.push_back(std::move(command));
+}
+
+void SimulationThread::SetThreadCount(int count)
+{
+    bool wasRunning = IsRunning();
+    Stop();
+    Simulation::SetThreadCount(count);
+    if (wasRunning) Start(*grid);
+}
+
+Grid& SimulationThread::Latest()
+{
+    if (threadsBeforeTurbo > 0 && !IsTurbo()) {
+        StopTurbo();
+    }
+
+    snapshots.Update();
+    return snapshots.Front().grid;
+}
+
+void SimulationThread::StartTurbo(bool stopWhenSettled)
+{
+    untilSettled = stopWhenSettled;
+    if (IsTurbo()) return;
+
+    // Every core works on the ticks while turbo lasts
+    int cores = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    if (cores > Simulation::GetThreadCount()) {
+        threadsBeforeTurbo = Simulation::GetThreadCount();
+        SetThreadCount(cores);
+    }
+    turbo = true;
+}
+
+void SimulationThread::StopTurbo()
+{
+    turbo = false;
+    if (threadsBeforeTurbo > 0) {
+        SetThreadCount(threadsBeforeTurbo);
+        threadsBeforeTurbo = 0;
+    }
+}
+
+void SimulationThread::Loop()
+{
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point last = Clock::now();
+    Clock::time_point rateStart = last;
+    uint64_t ticksSinceRate = 0;
+    tickClock.Reset();
+
+    while (running.load(std::memory_order_acquire)) {
+        RunCommands();
+
+        tickClock.SetTickRate(tickRate.load(std::memory_order_relaxed));
+        tickClock.SetMaxCatchUp(maxCatchUp.load(std::memory_order_relaxed));
+
+        Clock::time_point now = Clock::now();
+        int due = 0;
+        if (IsTurbo()) {
+            due = RunTurbo();
+            // Back to the tick rate from here, without a burst for the time turbo took
+            tickClock.Reset();
+            now = Clock::now();
+        }
+        else {
+            due = tickClock.Advance(std::chrono::duration<double>(now - last).count());
+            for (int i = 0; i < due; ++i) {
+                Simulation::Update(*grid);
+            }
+            if (due > 1) {
+                mergedTicks.fetch_add(due - 1, std::memory_order_relaxed);
+            }
+        }
+        last = now;
+
+        if (due > 0) {
+            tick += due;
+            Publish();
+
+            ticksSinceRate += due;
+            droppedTicks.store(tickClock.DroppedTicks(), std::memory_order_relaxed);
+        }
+
+        now = Clock::now();
+        if (now - rateStart >= std::chrono::milliseconds(500)) {
+            measuredTickRate = ticksSinceRate / std::chrono::duration<double>(now - rateStart).count();
+            rateStart = now;
+            ticksSinceRate = 0;
+        }
+
+        double wait = IsTurbo() ? 0.0 : tickClock.UntilNextTick();
+        if (wait > 0.0) {
+            std::this_thread::sleep_until(last + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(wait)));
+        }
+    }
+}
+
+int SimulationThread::RunTurbo()
+{
+    using Clock = std::chrono::steady_clock;
+
+    // Nothing in between is published, so the render thread only sees the last tick of each budget
+    Clock::time_point end = Clock::now() + std::chrono::milliseconds(turboBudget.load(std::memory_order_relaxed));
+    int count = 0;
+    do {
+        int moves = Simulation::Update(*grid);
+        ++count;
+
+        if (moves == 0 && untilSettled.load(std::memory_order_relaxed)) {
+            turbo = false;
+            break;
+        }
+    } while (Clock::now() < end);
+
+    return count;
+}
+
+void SimulationThread::RunCommands()
+{
+    {
+        std::lock_guard<std::mutex> lock(commandMutex);
+        runningCommands.swap(commands);
+    }
+
+    for (Command& command : runningCommands) {
+        command(*grid);
+    }
+    runningCommands.clear();
+}
+
+void SimulationThread::Publish()
+{
+    // A new size invalidates every version and rect of the old one
+    if (grid->Width() != layoutWidth || grid->Height() != layoutHeight) {
+        ++layout;
+        layoutWidth = grid->Width();
+        layoutHeight = grid->Height();
+
+        size_t chunkCount = static_cast<size_t>(grid->ChunksX()) * grid->ChunksY();
+        chunkVersions.assign(chunkCount, 0);
+        chunkHistory.assign(chunkCount, {});
+    }
+
+    changedRects.clear();
+    grid->TakeChangedRects(changedRects);
+    for (const DirtyRect& rect : changedRects) {
+        size_t index = static_cast<size_t>(rect.minY / Grid::ChunkSize) * grid->ChunksX() + rect.minX / Grid::ChunkSize;
+        uint64_t version = ++chunkVersions[index];
+        chunkHistory[index][version % HistorySize] = rect;
+    }
+
+    GridSnapshot& snapshot = snapshots.Back();
+    CopyTo(snapshot);
+    snapshot.tick = tick;
+    snapshots.Publish();
+}
+
+void SimulationThread::CopyTo(GridSnapshot& snapshot)
+{
+    if (snapshot.layout != layout) {
+        snapshot.grid.Resize(layoutWidth, layoutHeight, ResizeMode::CropOrPad);
+        snapshot.grid.CopyCells(*grid, { 0, 0, layoutWidth, layoutHeight });
+        snapshot.chunkVersions = chunkVersions;
+        snapshot.layout = layout;
+        return;
+    }
+
+    for (size_t index = 0; index < chunkVersions.size(); ++index) {
+        uint64_t have = snapshot.chunkVersions[index];
+        uint64_t want = chunkVersions[index];
+        if (have == want) continue;
+
+        DirtyRect rect;
+        if (want - have <= HistorySize) {
+            for (uint64_t version = have + 1; version <= want; ++version) {
+                const DirtyRect& changed = chunkHistory[index][version % HistorySize];
+                rect.Include(changed.minX, changed.minY, changed.maxX, changed.maxY);
+            }
+        }
+        else {
+            // Too far behind for the history, take the whole chunk
+            int cx = static_cast<int>(index % grid->ChunksX()) * Grid::ChunkSize;
+            int cy = static_cast<int>(index / grid->ChunksX()) * Grid::ChunkSize;
+            rect.Include(cx, cy, cx + Grid::ChunkSize, cy + Grid::ChunkSize);
+        }
+
+        snapshot.grid.CopyCells(*grid, rect);
+        snapshot.chunkVersions[index] = want;
+    }
+}
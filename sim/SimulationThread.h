@@ -0,0 +1,127 @@
+#pragma once
+#include "Grid.h"
+#include "SimClock.h"
+#include "TripleBuffer.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// The cells as of one finished tick, drawn by the render thread while the next ticks run
+struct GridSnapshot {
+	Grid grid{ 1, 1 };
+	// Live chunk versions the cells match, see SimulationThread
+	std::vector<uint64_t> chunkVersions;
+	// Size generation of the live grid they were copied from, 0 before the first copy
+	uint64_t layout = 0;
+	uint64_t tick = 0;
+};
+
+// Runs Simulation::Update on a thread of its own, so a slow tick never holds up a frame and
+// vsync never caps the tick rate. Ticks are paced by a SimClock; the ticks due at once run back
+// to back and only the last is published through a triple buffer, the render thread draws the
+// newest one. Anything that writes the live grid or the simulation settings is posted as a
+// command and runs on the simulation thread between two ticks.
+//
+// A snapshot is brought up to date by copying only the chunks whose version moved on since it
+// was last filled. Every chunk keeps the changed rects of its last HistorySize versions, so a
+// snapshot a few ticks behind copies just those rects instead of whole chunks.
+class SimulationThread
+{
+public:
+	using Command = std::function<void(Grid&)>;
+
+	static constexpr int HistorySize = 4;
+	static constexpr int DefaultTickRate = 60;
+	// Milliseconds of ticks per published snapshot in turbo mode, leaves room for a 60 Hz frame
+	static constexpr int DefaultTurboBudget = 14;
+
+private:
+	static inline Grid* grid = nullptr;
+	static inline std::thread thread;
+	static inline std::atomic<bool> running = false;
+	// Ticks per second to aim for, 0 runs ticks back to back. Read into the clock once per loop.
+	static inline std::atomic<int> tickRate = DefaultTickRate;
+	static inline std::atomic<int> maxCatchUp = SimClock::DefaultMaxCatchUp;
+	static inline SimClock tickClock{ DefaultTickRate };
+
+	// Turbo ignores the tick rate and runs ticks for turboBudget milliseconds before each publish.
+	// untilSettled ends it, from the simulation thread, after the first tick without a move.
+	static inline std::atomic<bool> turbo = false;
+	static inline std::atomic<bool> untilSettled = false;
+	static inline std::atomic<int> turboBudget = DefaultTurboBudget;
+	// Thread count to go back to once turbo ends, 0 while turbo has not changed it. Render thread only.
+	static inline int threadsBeforeTurbo = 0;
+
+	static inline std::mutex commandMutex;
+	static inline std::vector<Command> commands;
+	// Commands being run, swapped with commands so posting never waits for a tick
+	static inline std::vector<Command> runningCommands;
+
+	static inline TripleBuffer<GridSnapshot> snapshots;
+	static inline uint64_t tick = 0;
+
+	// Per live chunk in row-major order: bumped in every publish the chunk changed in,
+	// and the changed rect of each of the last HistorySize versions, indexed by version % HistorySize
+	static inline std::vector<uint64_t> chunkVersions;
+	static inline std::vector<std::array<DirtyRect, HistorySize>> chunkHistory;
+	static inline std::vector<DirtyRect> changedRects;
+	// Bumped whenever the live grid changes size
+	static inline uint64_t layout = 0;
+	static inline int layoutWidth = 0;
+	static inline int layoutHeight = 0;
+
+	static inline std::atomic<double> measuredTickRate = 0.0;
+	// Ticks skipped by the catch-up limit, and catch-up ticks run without a snapshot of their own
+	static inline std::atomic<uint64_t> droppedTicks = 0;
+	static inline std::atomic<uint64_t> mergedTicks = 0;
+
+	static void Loop();
+	// Run ticks for the turbo budget, returns how many ran
+	static int RunTurbo();
+	static void RunCommands();
+	// Give the live grid's changes new chunk versions, bring the back snapshot up to date and publish it
+	static void Publish();
+	static void CopyTo(GridSnapshot& snapshot);
+
+public:
+	// Publish the current cells and start ticking live. The grid must outlive Stop.
+	static void Start(Grid& live);
+	// Finish the tick in progress and join the thread, queued commands still run
+	static void Stop();
+	static bool IsRunning() { return running.load(std::memory_order_relaxed); }
+
+	// Run command on the simulation thread before the next tick, or right away when it is not running
+	static void Post(Command command);
+	// Resize the task scheduler with the thread stopped, it cannot change size while another thread queues work
+	static void SetThreadCount(int count);
+
+	// Render thread: the newest published cells. Stays valid and unchanged until the next call.
+	// Also restores the thread count once a run until settled has ended.
+	static Grid& Latest();
+
+	// Render thread: run ticks as fast as every core allows, publishing once per turbo budget.
+	// With untilSettled set, turbo ends by itself after the first tick in which nothing moved.
+	static void StartTurbo(bool stopWhenSettled);
+	static void StopTurbo();
+	static bool IsTurbo() { return turbo.load(std::memory_order_relaxed); }
+	static bool IsRunningUntilSettled() { return IsTurbo() && untilSettled.load(std::memory_order_relaxed); }
+	static void SetTurboBudget(int milliseconds) { turboBudget = milliseconds; }
+	static int GetTurboBudget() { return turboBudget; }
+
+	static void SetTickRate(int ticksPerSecond) { tickRate = ticksPerSecond; }
+	static int GetTickRate() { return tickRate; }
+	// Most ticks run in one go when the simulation falls behind, the rest are dropped
+	static void SetMaxCatchUp(int ticks) { maxCatchUp = ticks; }
+	static int GetMaxCatchUp() { return maxCatchUp; }
+	// Ticks actually run per second, measured over the last half second
+	static double MeasuredTickRate() { return measuredTickRate.load(std::memory_order_relaxed); }
+	// Number of ticks run before the cells shown by Latest
+	static uint64_t LatestTick() { return snapshots.Front().tick; }
+	static uint64_t DroppedTicks() { return droppedTicks.load(std::memory_order_relaxed); }
+	static uint64_t MergedTicks() { return mergedTicks.load(std::memory_order_relaxed); }
+};
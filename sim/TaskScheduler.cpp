@@ -0,0 +1,176 @@
+#include "TaskScheduler.h"
+#include <algorithm>
+
+
+void TaskGroup::Run(std::function<void()> task)
+{
+    TaskScheduler::Submit(*this, std::move(task));
+}
+
+void TaskGroup::Wait()
+{
+    while (Busy())
+    {
+        // Help out instead of blocking, the tasks we wait on may be sitting in our own deque
+        if (TaskScheduler::TryRunOne(this)) continue;
+
+        // The rest are running elsewhere. Wake up when the last one finishes, or now and then in case one submits more.
+        std::unique_lock<std::mutex> lock(TaskScheduler::doneMutex);
+        TaskScheduler::doneCondition.wait_for(lock, TaskScheduler::WaitInterval, [this]() { return !Busy(); });
+    }
+}
+
+void TaskScheduler::Start(int threadCount)
+{
+    Stop();
+
+    threadCount = std::max(1, threadCount);
+    workers.clear();
+    for (int i = 0; i < threadCount; ++i) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+
+    running = true;
+    for (int i = 1; i < threadCount; ++i) {
+        threads.emplace_back(WorkerLoop, i);
+    }
+}
+
+void TaskScheduler::Stop()
+{
+    if (threads.empty()) return;
+
+    // Drain whatever is still queued before the workers go away
+    while (queuedTasks.load() > 0) {
+        if (!TryRunOne()) {
+            std::this_thread::yield();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        running = false;
+    }
+    sleepCondition.notify_all();
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+}
+
+void TaskScheduler::Resize(int threadCount)
+{
+    if (std::max(1, threadCount) != ThreadCount() || workers.empty()) {
+        Start(threadCount);
+    }
+}
+
+void TaskScheduler::Submit(TaskGroup& group, std::function<void()> task)
+{
+    group.pending.fetch_add(1, std::memory_order_relaxed);
+
+    if (threads.empty()) {
+        Task inlineTask{ std::move(task), &group };
+        Execute(inlineTask);
+        return;
+    }
+
+    Worker& worker = *workers[workerIndex];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back({ std::move(task), &group });
+    }
+    queuedTasks.fetch_add(1, std::memory_order_release);
+
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    sleepCondition.notify_one();
+}
+
+void TaskScheduler::ParallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body)
+{
+    if (begin >= end) return;
+    grain = std::max(1, grain);
+
+    if (threads.empty() || end - begin <= grain) {
+        body(begin, end);
+        return;
+    }
+
+    TaskGroup group;
+    for (int first = begin; first < end; first += grain) {
+        int last = std::min(first + grain, end);
+        group.Run([&body, first, last]() { body(first, last); });
+    }
+    group.Wait();
+}
+
+void TaskScheduler::Execute(Task& task)
+{
+    task.function();
+
+    // The group may be gone as soon as its count reaches 0, only the scheduler's own state is touched after
+    if (task.group->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        {
+            std::lock_guard<std::mutex> lock(doneMutex);
+        }
+        doneCondition.notify_all();
+    }
+}
+
+bool TaskScheduler::TryRunOne(const TaskGroup* only)
+{
+    if (workers.empty()) return false;
+
+    Task task;
+    bool found = false;
+
+    auto matches = [only](const Task& queued) { return !only || queued.group == only; };
+
+    // Newest task from our own deque first, it is the most likely to still be in cache
+    {
+        Worker& own = *workers[workerIndex];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        auto it = std::find_if(own.tasks.rbegin(), own.tasks.rend(), matches);
+        if (it != own.tasks.rend()) {
+            task = std::move(*it);
+            own.tasks.erase(std::next(it).base());
+            found = true;
+        }
+    }
+
+    // Otherwise steal the oldest task of another deque
+    const int count = static_cast<int>(workers.size());
+    for (int i = 1; i < count && !found; ++i) {
+        Worker& victim = *workers[(workerIndex + i) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        auto it = std::find_if(victim.tasks.begin(), victim.tasks.end(), matches);
+        if (it != victim.tasks.end()) {
+            task = std::move(*it);
+            victim.tasks.erase(it);
+            found = true;
+        }
+    }
+
+    if (!found) return false;
+
+    queuedTasks.fetch_sub(1, std::memory_order_acq_rel);
+    Execute(task);
+    return true;
+}
+
+void TaskScheduler::WorkerLoop(int index)
+{
+    workerIndex = index;
+
+    while (true)
+    {
+        if (TryRunOne()) continue;
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepCondition.wait(lock, []() { return !running || queuedTasks.load() > 0; });
+        if (!running && queuedTasks.load() == 0) break;
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Set of tasks that can be waited on together
+class TaskGroup
+{
+private:
+	std::atomic<int> pending = 0;
+
+	friend class TaskScheduler;
+
+public:
+	// Queue a task on the scheduler as part of this group
+	void Run(std::function<void()> task);
+	// Block until every task of the group has finished, running its queued tasks meanwhile.
+	// Tasks of other groups are left to the workers, so a slow unrelated task never holds up the wait.
+	void Wait();
+	// True while tasks of the group are queued or running
+	bool Busy() const { return pending.load(std::memory_order_acquire) > 0; }
+};
+
+// Work-stealing thread pool shared by the simulation, rendering prep and I/O.
+// Every worker owns a deque: it pushes and pops at the back, idle workers steal from the front.
+// Queue 0 belongs to threads outside the pool, such as the main thread.
+class TaskScheduler
+{
+public:
+	// Longest a TaskGroup::Wait sleeps before looking for new tasks of its group again
+	static constexpr std::chrono::milliseconds WaitInterval{ 1 };
+
+private:
+	struct Task {
+		std::function<void()> function;
+		TaskGroup* group;
+	};
+
+	struct Worker {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	static inline std::vector<std::unique_ptr<Worker>> workers;
+	static inline std::vector<std::thread> threads;
+	static inline std::atomic<bool> running = false;
+	static inline std::atomic<int> queuedTasks = 0;
+	static inline std::mutex sleepMutex;
+	static inline std::condition_variable sleepCondition;
+	static inline thread_local int workerIndex = 0;
+	// Signalled whenever the last task of a group finishes
+	static inline std::mutex doneMutex;
+	static inline std::condition_variable doneCondition;
+
+	static void WorkerLoop(int index);
+	// Pop a task from the calling thread's deque or steal one, of group only unless it is null.
+	// Returns false if no deque holds such a task.
+	static bool TryRunOne(const TaskGroup* only = nullptr);
+	static void Execute(Task& task);
+
+	friend class TaskGroup;
+
+public:
+	// Start the pool with threadCount threads in total, the calling thread counts as one
+	static void Start(int threadCount);
+	// Finish queued work and join the worker threads
+	static void Stop();
+	// Restart the pool if the thread count changed
+	static void Resize(int threadCount);
+	// Threads available to run tasks, including the calling thread
+	static int ThreadCount() { return static_cast<int>(threads.size()) + 1; }
+
+	// Queue a task, it runs inline when the pool has no worker threads
+	static void Submit(TaskGroup& group, std::function<void()> task);
+	// Run body(first, last) over [begin, end) split into ranges of at most grain items, and wait for all of them
+	static void ParallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body);
+};
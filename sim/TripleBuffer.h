@@ -0,0 +1,44 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+
+// Lock-free hand-off of the newest value from one writer thread to one reader thread.
+// The writer fills the back slot and publishes it, the reader takes the newest published slot.
+// Neither side ever waits: a value the reader has not taken yet is simply replaced by a newer one.
+template <typename T>
+class TripleBuffer
+{
+private:
+	// The middle slot index, plus a bit set while it holds a value the reader has not taken
+	static constexpr uint8_t IndexMask = 3;
+	static constexpr uint8_t FreshBit = 4;
+
+	T slots[3];
+	std::atomic<uint8_t> middle = 1;
+	// Owned by the writer and the reader
+	uint8_t back = 0;
+	uint8_t front = 2;
+
+public:
+	// Every slot, for setup while neither thread is running
+	T& Slot(int index) { return slots[index]; }
+
+	// Writer side: the slot to fill next
+	T& Back() { return slots[back]; }
+	// Writer side: hand the back slot to the reader and take the middle one as the new back
+	void Publish()
+	{
+		back = middle.exchange(back | FreshBit, std::memory_order_acq_rel) & IndexMask;
+	}
+
+	// Reader side: switch to the newest published slot, returns false if nothing new arrived
+	bool Update()
+	{
+		if ((middle.load(std::memory_order_relaxed) & FreshBit) == 0) return false;
+		front = middle.exchange(front, std::memory_order_acq_rel) & IndexMask;
+		return true;
+	}
+	// Reader side: the slot taken by the last Update
+	T& Front() { return slots[front]; }
+};
@@ -0,0 +1,73 @@
+// Feeds SimClock known amounts of time and checks the ticks it hands out. A rate of 64 makes
+// every step a power of two, so the sums below are exact.
+#include "SimClock.h"
+#include <iostream>
+
+
+static int failures = 0;
+
+static void Expect(bool condition, const char* what)
+{
+    if (!condition) {
+        std::cerr << "Failed: " << what << std::endl;
+        ++failures;
+    }
+}
+
+int main()
+{
+    const double step = 1.0 / 64;
+
+    // Whole ticks come out, the fraction carries over to the next call
+    {
+        SimClock clock(64);
+        Expect(clock.Advance(1.5 * step) == 1, "one and a half steps give one tick");
+        Expect(clock.Advance(0.5 * step) == 1, "the carried half step completes a tick");
+        Expect(clock.Advance(0.25 * step) == 0, "a quarter step gives no tick");
+        Expect(clock.UntilNextTick() == 0.75 * step, "three quarters of a step remain");
+        Expect(clock.Ticks() == 2 && clock.DroppedTicks() == 0, "two ticks handed out, none dropped");
+        Expect(clock.Advance(-1.0) == 0 && clock.UntilNextTick() == 0.75 * step, "negative time is ignored");
+    }
+
+    // Falling behind hands out at most MaxCatchUp ticks and drops the rest, keeping the phase
+    {
+        SimClock clock(64);
+        Expect(clock.Advance(10.5 * step) == SimClock::DefaultMaxCatchUp, "catch-up is clamped");
+        Expect(clock.DroppedTicks() == 10 - SimClock::DefaultMaxCatchUp, "the excess ticks are counted as dropped");
+        Expect(clock.UntilNextTick() == 0.5 * step, "the half step past the last tick is kept");
+        Expect(clock.Advance(0.5 * step) == 1, "the kept half step completes a tick");
+
+        clock.SetMaxCatchUp(0);
+        Expect(clock.GetMaxCatchUp() == 1, "catch-up is at least one tick");
+        Expect(clock.Advance(3.0 * step) == 1 && clock.DroppedTicks() == 12 - SimClock::DefaultMaxCatchUp, "a limit of one drops the other two");
+        Expect(clock.Ticks() == SimClock::DefaultMaxCatchUp + 2, "ticks count only those handed out");
+    }
+
+    // Time saved up at one rate does not come out at another
+    {
+        SimClock clock(64);
+        Expect(clock.Advance(0.75 * step) == 0, "three quarters of a step give no tick");
+        clock.SetTickRate(64);
+        Expect(clock.UntilNextTick() == 0.25 * step, "setting the same rate keeps the accumulator");
+        clock.SetTickRate(128);
+        Expect(clock.GetTickRate() == 128, "the new rate is set");
+        Expect(clock.Advance(0.0) == 0, "the saved time was dropped with the old rate");
+        Expect(clock.UntilNextTick() == 0.5 * step, "a whole step of the new rate remains");
+    }
+
+    // Rate 0 hands out one tick per call however much time passed
+    {
+        SimClock clock(0);
+        Expect(clock.Advance(0.0) == 1, "no time still gives a tick");
+        Expect(clock.Advance(100.0) == 1, "a long wait still gives one tick");
+        Expect(clock.Ticks() == 2 && clock.DroppedTicks() == 0, "two ticks handed out, none dropped");
+        Expect(clock.UntilNextTick() == 0.0, "the next tick is always due");
+
+        clock.SetTickRate(-5);
+        Expect(clock.GetTickRate() == 0, "negative rates mean unlimited");
+        clock.SetTickRate(64);
+        Expect(clock.Advance(0.5 * step) == 0, "a limited rate paces ticks again");
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,70 @@
+// Posts settings changes and reads them back every "frame" while the simulation thread ticks,
+// the way the UI does. Build with -fsanitize=thread to catch settings shared without atomics.
+#include "Grid.h"
+#include "Simulation.h"
+#include "SimulationThread.h"
+#include "TaskScheduler.h"
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+
+int main()
+{
+    TaskScheduler::Start(1);
+    Simulation::SetThreadCount(1);
+
+    Grid grid(128, 128);
+    size_t seeded = 0;
+    for (int y = 0; y < 64; ++y) {
+        for (int x = 32; x < 96; x += 2) {
+            grid.Set(x, y, Element::Make(ElementType::Sand));
+            ++seeded;
+        }
+    }
+    // Stone keeps the bit planes from running, so the fallback flag flips as the engine changes
+    grid.Set(0, 127, Element::Make(ElementType::Stone));
+    ++seeded;
+
+    SimulationThread::SetTickRate(0);
+    SimulationThread::Start(grid);
+
+    int failures = 0;
+    for (int frame = 0; frame < 200; ++frame) {
+        Simulation::Engine engine = frame % 3 == 0 ? Simulation::Engine::BitPlanes : Simulation::Engine::Cells;
+        bool doubleBuffered = frame % 5 == 0;
+        bool worklist = frame % 7 != 0;
+        SimulationThread::Post([=](Grid&) {
+            Simulation::SetEngine(engine);
+            Simulation::SetDoubleBuffered(doubleBuffered);
+            Simulation::SetWorklist(worklist);
+        });
+
+        // Everything the settings window reads each frame
+        volatile bool shown = Simulation::IsDoubleBuffered() | Simulation::IsWorklistEnabled() | Simulation::IsOnBitPlanes() |
+            (Simulation::GetEngine() == Simulation::Engine::BitPlanes);
+        (void)shown;
+
+        const Grid& latest = SimulationThread::Latest();
+        if (latest.Width() == grid.Width() && latest.ParticleCount() != seeded) {
+            std::cerr << "Frame " << frame << " shows " << latest.ParticleCount() << " particles, expected " << seeded << std::endl;
+            ++failures;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // Stop runs the commands still queued, so the last settings posted are the ones in effect
+    SimulationThread::Stop();
+    if (Simulation::GetEngine() != Simulation::Engine::Cells || Simulation::IsDoubleBuffered() || !Simulation::IsWorklistEnabled()) {
+        std::cerr << "The last posted settings were not applied" << std::endl;
+        ++failures;
+    }
+    if (grid.ParticleCount() != seeded) {
+        std::cerr << "Live grid holds " << grid.ParticleCount() << " particles, expected " << seeded << std::endl;
+        ++failures;
+    }
+
+    TaskScheduler::Stop();
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,32 @@
+# Runs sandsim_bench once per argument set and fails unless every run exits cleanly, so no cell of
+# any type was lost or made, and all of them print the same checksum.
+#   cmake -DBENCH=<sandsim_bench> -DRUNS="<args>|<args>|..." -P CompareBench.cmake
+
+string(REPLACE "|" ";" runs "${RUNS}")
+
+set(expected "")
+foreach(run IN LISTS runs)
+    separate_arguments(args UNIX_COMMAND "${run}")
+    execute_process(COMMAND "${BENCH}" ${args}
+        RESULT_VARIABLE result
+        OUTPUT_VARIABLE output
+        ERROR_VARIABLE error)
+
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "sandsim_bench ${run} failed (${result}):\n${output}${error}")
+    endif()
+
+    string(REGEX MATCH "checksum ([0-9a-f]+)" match "${output}")
+    if(NOT match)
+        message(FATAL_ERROR "sandsim_bench ${run} printed no checksum:\n${output}")
+    endif()
+    set(checksum "${CMAKE_MATCH_1}")
+    message(STATUS "${run}: ${checksum}")
+
+    if(expected STREQUAL "")
+        set(expected "${checksum}")
+        set(expectedRun "${run}")
+    elseif(NOT checksum STREQUAL expected)
+        message(FATAL_ERROR "sandsim_bench ${run} gave checksum ${checksum}, ${expectedRun} gave ${expected}")
+    endif()
+endforeach()